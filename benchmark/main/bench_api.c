@@ -0,0 +1,491 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_check.h"
+#include "nvs.h"
+
+#include "bench_common.h"
+#include "non_volatile_storage.h"
+
+#define API_ITERATIONS     500   // Measured operations per case
+#define API_MAX_VALUE_SIZE 1900  // Largest string and blob
+#define API_MAX_NAMESPACES 16
+#define FILL_BLOB_SIZE     1000  // Size of the blobs used to fill the partition
+
+static const char *FILL_NAMESPACE = "bench_fill";
+
+typedef struct {
+    uint32_t keys;        // Keys used round-robin in every namespace
+    uint32_t namespaces;  // Namespaces the operations are spread over
+    uint32_t fill;        // Percent of the partition used by other values during the case
+    size_t value_size;    // Size of strings (including the terminator) and blobs
+} api_params_t;
+
+// One call of an nvs_read_*() or nvs_write_*() function, iteration makes every written value different
+typedef esp_err_t (*api_operation_t)(const char *namespace, const char *key, uint32_t iteration, size_t size);
+
+typedef struct {
+    const char *name;
+    api_operation_t operation;
+    api_operation_t prepare;  // Writes the value a read needs, NULL for writes
+} api_case_t;
+
+static char value_buffer[API_MAX_VALUE_SIZE];
+
+static const char *string_value(uint32_t iteration, size_t size)
+{
+    memset(value_buffer, 'a' + iteration % 26, size - 1);
+    value_buffer[size - 1] = '\0';
+    return value_buffer;
+}
+
+static esp_err_t write_int8(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)size;
+    return nvs_write_int8(namespace, key, (int8_t)iteration);
+}
+
+static esp_err_t write_uint8(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)size;
+    return nvs_write_uint8(namespace, key, (uint8_t)iteration);
+}
+
+static esp_err_t write_int16(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)size;
+    return nvs_write_int16(namespace, key, (int16_t)iteration);
+}
+
+static esp_err_t write_uint16(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)size;
+    return nvs_write_uint16(namespace, key, (uint16_t)iteration);
+}
+
+static esp_err_t write_int32(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)size;
+    return nvs_write_int32(namespace, key, (int32_t)iteration);
+}
+
+static esp_err_t write_uint32(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)size;
+    return nvs_write_uint32(namespace, key, iteration);
+}
+
+static esp_err_t write_int64(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)size;
+    return nvs_write_int64(namespace, key, -(int64_t)iteration);
+}
+
+static esp_err_t write_uint64(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)size;
+    return nvs_write_uint64(namespace, key, (uint64_t)iteration << 32);
+}
+
+static esp_err_t write_float(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)size;
+    return nvs_write_float(namespace, key, (float)iteration / 3.0f);
+}
+
+static esp_err_t write_double(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)size;
+    return nvs_write_double(namespace, key, (double)iteration / 3.0);
+}
+
+static esp_err_t write_string(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    return nvs_write_string(namespace, key, string_value(iteration, size));
+}
+
+static esp_err_t write_blob(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    memset(value_buffer, (int)iteration, size);
+    return nvs_write_blob(namespace, key, value_buffer, size);
+}
+
+static esp_err_t read_int8(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)iteration;
+    (void)size;
+    int8_t value;
+    return nvs_read_int8(namespace, key, &value);
+}
+
+static esp_err_t read_uint8(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)iteration;
+    (void)size;
+    uint8_t value;
+    return nvs_read_uint8(namespace, key, &value);
+}
+
+static esp_err_t read_int16(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)iteration;
+    (void)size;
+    int16_t value;
+    return nvs_read_int16(namespace, key, &value);
+}
+
+static esp_err_t read_uint16(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)iteration;
+    (void)size;
+    uint16_t value;
+    return nvs_read_uint16(namespace, key, &value);
+}
+
+static esp_err_t read_int32(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)iteration;
+    (void)size;
+    int32_t value;
+    return nvs_read_int32(namespace, key, &value);
+}
+
+static esp_err_t read_uint32(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)iteration;
+    (void)size;
+    uint32_t value;
+    return nvs_read_uint32(namespace, key, &value);
+}
+
+static esp_err_t read_int64(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)iteration;
+    (void)size;
+    int64_t value;
+    return nvs_read_int64(namespace, key, &value);
+}
+
+static esp_err_t read_uint64(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)iteration;
+    (void)size;
+    uint64_t value;
+    return nvs_read_uint64(namespace, key, &value);
+}
+
+static esp_err_t read_float(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)iteration;
+    (void)size;
+    float value;
+    return nvs_read_float(namespace, key, &value);
+}
+
+static esp_err_t read_double(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)iteration;
+    (void)size;
+    double value;
+    return nvs_read_double(namespace, key, &value);
+}
+
+static esp_err_t read_string(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)iteration;
+    (void)size;
+    char *value = NULL;
+    esp_err_t err = nvs_read_string(namespace, key, &value);
+    free(value);
+    return err;
+}
+
+static esp_err_t read_string_into(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)iteration;
+    (void)size;
+    size_t length = sizeof(value_buffer);
+    return nvs_read_string_into(namespace, key, value_buffer, &length);
+}
+
+static esp_err_t read_blob(const char *namespace, const char *key, uint32_t iteration, size_t size)
+{
+    (void)iteration;
+    return nvs_read_blob(namespace, key, value_buffer, size);
+}
+
+static const api_case_t TYPED_CASES[] = {
+    { "write_int8", write_int8, NULL },
+    { "write_uint8", write_uint8, NULL },
+    { "write_int16", write_int16, NULL },
+    { "write_uint16", write_uint16, NULL },
+    { "write_int32", write_int32, NULL },
+    { "write_uint32", write_uint32, NULL },
+    { "write_int64", write_int64, NULL },
+    { "write_uint64", write_uint64, NULL },
+    { "write_float", write_float, NULL },
+    { "write_double", write_double, NULL },
+    { "write_string", write_string, NULL },
+    { "write_blob", write_blob, NULL },
+    { "read_int8", read_int8, write_int8 },
+    { "read_uint8", read_uint8, write_uint8 },
+    { "read_int16", read_int16, write_int16 },
+    { "read_uint16", read_uint16, write_uint16 },
+    { "read_int32", read_int32, write_int32 },
+    { "read_uint32", read_uint32, write_uint32 },
+    { "read_int64", read_int64, write_int64 },
+    { "read_uint64", read_uint64, write_uint64 },
+    { "read_float", read_float, write_float },
+    { "read_double", read_double, write_double },
+    { "read_string", read_string, write_string },
+    { "read_string_into", read_string_into, write_string },
+    { "read_blob", read_blob, write_blob },
+};
+
+static const api_case_t STRING_CASES[] = {
+    { "write_string", write_string, NULL },
+    { "read_string_into", read_string_into, write_string },
+    { "write_blob", write_blob, NULL },
+    { "read_blob", read_blob, write_blob },
+};
+
+static const api_case_t UINT32_CASES[] = {
+    { "write_uint32", write_uint32, NULL },
+    { "read_uint32", read_uint32, write_uint32 },
+};
+
+static const api_case_t FILL_CASES[] = {
+    { "write_uint32", write_uint32, NULL },
+    { "write_blob", write_blob, NULL },
+};
+
+static void api_namespace(char *namespace, size_t size, uint32_t index)
+{
+    snprintf(namespace, size, "bench_api_%02u", (unsigned)(index % 100));  // Two digits fill a namespace name
+}
+
+static void api_key(char *key, size_t size, uint32_t index)
+{
+    snprintf(key, size, "key_%03u", (unsigned)index);
+}
+
+// Write blobs to another namespace until the given percentage of the partition's entries is used
+static void fill_partition(uint32_t percent)
+{
+    static uint8_t filler[FILL_BLOB_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_stats_t stats;
+    ESP_ERROR_CHECK(nvs_get_stats(NULL, &stats));
+    for (uint32_t i = 0; stats.used_entries * 100 < stats.total_entries * percent; ++i) {
+        snprintf(key, sizeof(key), "fill_%u", (unsigned)i);
+        ESP_ERROR_CHECK(nvs_write_blob(FILL_NAMESPACE, key, filler, sizeof(filler)));
+        ESP_ERROR_CHECK(nvs_get_stats(NULL, &stats));
+    }
+}
+
+static void run_case(const api_case_t *api_case, const api_params_t *params)
+{
+    char namespace[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+
+    fill_partition(params->fill);
+    if (api_case->prepare != NULL) {
+        for (uint32_t n = 0; n < params->namespaces; ++n) {
+            api_namespace(namespace, sizeof(namespace), n);
+            for (uint32_t k = 0; k < params->keys; ++k) {
+                api_key(key, sizeof(key), k);
+                ESP_ERROR_CHECK(api_case->prepare(namespace, key, k, params->value_size));
+            }
+        }
+    }
+
+    bench_samples_t samples;
+    bench_samples_init(&samples, API_ITERATIONS);
+    for (uint32_t i = 0; i < API_ITERATIONS; ++i) {
+        api_namespace(namespace, sizeof(namespace), i % params->namespaces);
+        api_key(key, sizeof(key), (i / params->namespaces) % params->keys);
+        uint64_t start = bench_now_ns();
+        ESP_ERROR_CHECK(api_case->operation(namespace, key, i, params->value_size));
+        bench_samples_add(&samples, bench_now_ns() - start);
+    }
+
+    char description[96];
+    snprintf(description, sizeof(description), "keys=%u namespaces=%u fill=%u value_size=%u",
+             (unsigned)params->keys, (unsigned)params->namespaces, (unsigned)params->fill,
+             (unsigned)params->value_size);
+    bench_report_samples("api", api_case->name, description, &samples);
+
+    // Every case starts from the same partition contents
+    for (uint32_t n = 0; n < params->namespaces; ++n) {
+        api_namespace(namespace, sizeof(namespace), n);
+        ESP_ERROR_CHECK(nvs_erase_namespace(namespace));
+    }
+    ESP_ERROR_CHECK(nvs_erase_namespace(FILL_NAMESPACE));
+}
+
+static void run_cases(const api_case_t *cases, size_t count, const api_params_t *params)
+{
+    for (size_t i = 0; i < count; ++i) {
+        run_case(&cases[i], params);
+    }
+}
+
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+
+#define BOUND_KEYS 4  // Fixed keys of a control loop
+
+// The same keys read and written through nvs_key_bind() refs, to compare with read_uint32/write_uint32 at keys=4
+static void run_bound_cases(void)
+{
+    char namespace[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_key_ref_t refs[BOUND_KEYS];
+    api_namespace(namespace, sizeof(namespace), 0);
+    for (uint32_t k = 0; k < BOUND_KEYS; ++k) {
+        api_key(key, sizeof(key), k);
+        ESP_ERROR_CHECK(nvs_key_bind(namespace, key, NVS_TYPE_U32, &refs[k]));
+        ESP_ERROR_CHECK(nvs_write_uint32(namespace, key, k));
+    }
+
+    bench_samples_t samples;
+    bench_samples_init(&samples, API_ITERATIONS);
+    for (uint32_t i = 0; i < API_ITERATIONS; ++i) {
+        uint32_t value;
+        uint64_t start = bench_now_ns();
+        ESP_ERROR_CHECK(nvs_key_read(&refs[i % BOUND_KEYS], &value, NULL));
+        bench_samples_add(&samples, bench_now_ns() - start);
+    }
+    bench_report_samples("api", "read_uint32_bound", "keys=4 namespaces=1 fill=0 value_size=4", &samples);
+
+    bench_samples_init(&samples, API_ITERATIONS);
+    for (uint32_t i = 0; i < API_ITERATIONS; ++i) {
+        uint64_t start = bench_now_ns();
+        ESP_ERROR_CHECK(nvs_key_write(&refs[i % BOUND_KEYS], &i, 0));
+        bench_samples_add(&samples, bench_now_ns() - start);
+    }
+    bench_report_samples("api", "write_uint32_bound", "keys=4 namespaces=1 fill=0 value_size=4", &samples);
+    ESP_ERROR_CHECK(nvs_erase_namespace(namespace));
+}
+
+#define PROVISION_KEYS   16  // Keys a first boot finds missing
+#define PROVISION_ROUNDS 20
+
+// First boot: every key is missing and gets its default written, one write per key or one batch per namespace
+static void run_provision_cases(void)
+{
+    char namespace[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    api_namespace(namespace, sizeof(namespace), 0);
+
+    uint64_t elapsed_ns = 0;
+    for (uint32_t round = 0; round < PROVISION_ROUNDS; ++round) {
+        uint64_t start = bench_now_ns();
+        for (uint32_t k = 0; k < PROVISION_KEYS; ++k) {
+            uint32_t value;
+            api_key(key, sizeof(key), k);
+            if (nvs_read_uint32(namespace, key, &value) == ESP_ERR_NVS_NOT_FOUND) {
+                ESP_ERROR_CHECK(nvs_write_uint32(namespace, key, k));
+            }
+        }
+        elapsed_ns += bench_now_ns() - start;
+        ESP_ERROR_CHECK(nvs_erase_namespace(namespace));
+    }
+    bench_report("api", "provision_read_write", PROVISION_ROUNDS * PROVISION_KEYS, elapsed_ns);
+
+    elapsed_ns = 0;
+    for (uint32_t round = 0; round < PROVISION_ROUNDS; ++round) {
+        uint64_t start = bench_now_ns();
+        for (uint32_t k = 0; k < PROVISION_KEYS; ++k) {
+            api_key(key, sizeof(key), k);
+            nvs_read_uint32_or_default(namespace, key, k, NVS_DEFAULT_PERSIST);
+        }
+        ESP_ERROR_CHECK(nvs_defaults_flush());
+        elapsed_ns += bench_now_ns() - start;
+        ESP_ERROR_CHECK(nvs_erase_namespace(namespace));
+    }
+    bench_report("api", "provision_or_default", PROVISION_ROUNDS * PROVISION_KEYS, elapsed_ns);
+}
+
+static void count_change(const char *namespace, const char *key, nvs_type_t type, const void *value, size_t length,
+                         void *ctx)
+{
+    (void)namespace;
+    (void)key;
+    (void)type;
+    (void)value;
+    (void)length;
+    ++*(uint32_t*)ctx;
+}
+
+// write_uint32 at keys=16 with a subscription of another namespace (dispatch finds no match) and of the written keys
+static void run_subscribed_cases(void)
+{
+    static const struct {
+        const char *name;
+        const char *namespace;  // Subscribed namespace, NULL for the written one
+    } CASES[] = {
+        { "write_uint32_subscribed_other", "bench_other" },
+        { "write_uint32_subscribed", NULL },
+    };
+    char namespace[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    api_namespace(namespace, sizeof(namespace), 0);
+
+    for (size_t c = 0; c < ARRAY_SIZE(CASES); ++c) {
+        uint32_t changes = 0;
+        ESP_ERROR_CHECK(nvs_subscribe((CASES[c].namespace != NULL) ? CASES[c].namespace : namespace, "key_*",
+                                      count_change, &changes));
+        bench_samples_t samples;
+        bench_samples_init(&samples, API_ITERATIONS);
+        for (uint32_t i = 0; i < API_ITERATIONS; ++i) {
+            api_key(key, sizeof(key), i % 16);
+            uint64_t start = bench_now_ns();
+            ESP_ERROR_CHECK(nvs_write_uint32(namespace, key, i));
+            bench_samples_add(&samples, bench_now_ns() - start);
+        }
+        ESP_ERROR_CHECK(nvs_unsubscribe(count_change, &changes));
+        bench_report_samples("api", CASES[c].name, "keys=16 namespaces=1 fill=0 value_size=4", &samples);
+        ESP_ERROR_CHECK(nvs_erase_namespace(namespace));
+    }
+}
+
+void bench_api(void)
+{
+    static const size_t VALUE_SIZES[] = { 16, 256, API_MAX_VALUE_SIZE };
+    static const uint32_t KEY_COUNTS[] = { 1, 16, 256 };
+    static const uint32_t NAMESPACE_COUNTS[] = { 1, 4, API_MAX_NAMESPACES };  // More than the handle cache
+    static const uint32_t FILL_LEVELS[] = { 0, 50, 75 };
+    const api_params_t defaults = { .keys = 16, .namespaces = 1, .fill = 0, .value_size = 32 };
+
+    // Every entry point with the default parameters
+    run_cases(TYPED_CASES, ARRAY_SIZE(TYPED_CASES), &defaults);
+
+    for (size_t i = 0; i < ARRAY_SIZE(VALUE_SIZES); ++i) {
+        api_params_t params = defaults;
+        params.value_size = VALUE_SIZES[i];
+        run_cases(STRING_CASES, ARRAY_SIZE(STRING_CASES), &params);
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(KEY_COUNTS); ++i) {
+        api_params_t params = defaults;
+        params.keys = KEY_COUNTS[i];
+        run_cases(UINT32_CASES, ARRAY_SIZE(UINT32_CASES), &params);
+    }
+    api_params_t bound_params = defaults;
+    bound_params.keys = BOUND_KEYS;
+    run_cases(UINT32_CASES, ARRAY_SIZE(UINT32_CASES), &bound_params);
+    run_bound_cases();
+    run_provision_cases();
+    run_subscribed_cases();
+    for (size_t i = 0; i < ARRAY_SIZE(NAMESPACE_COUNTS); ++i) {
+        api_params_t params = defaults;
+        params.namespaces = NAMESPACE_COUNTS[i];
+        run_cases(UINT32_CASES, ARRAY_SIZE(UINT32_CASES), &params);
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(FILL_LEVELS); ++i) {
+        api_params_t params = defaults;
+        params.fill = FILL_LEVELS[i];
+        params.value_size = 256;
+        run_cases(FILL_CASES, ARRAY_SIZE(FILL_CASES), &params);
+    }
+}
@@ -0,0 +1,58 @@
+#include <stdio.h>
+
+#include "esp_check.h"
+
+#include "bench_common.h"
+#include "non_volatile_storage.h"
+
+#define SENSOR_KEYS    10   // Number of values updated by the sensor task
+#define SENSOR_UPDATES 100  // How many times each value is updated
+
+static const char *NAMESPACE = "bench_async";
+
+static void sensor_key(char *key, size_t size, uint32_t sensor)
+{
+    snprintf(key, size, "sensor_%02u", (unsigned)sensor);
+}
+
+// Time spent by the writing task only, which is what a real-time task cares about
+static uint64_t write_updates(void)
+{
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint64_t start = bench_now_ns();
+    for (uint32_t update = 0; update < SENSOR_UPDATES; ++update) {
+        for (uint32_t sensor = 0; sensor < SENSOR_KEYS; ++sensor) {
+            sensor_key(key, sizeof(key), sensor);
+            ESP_ERROR_CHECK(nvs_write_uint32(NAMESPACE, key, update * SENSOR_KEYS + sensor));
+        }
+    }
+    return bench_now_ns() - start;
+}
+
+static void bench_sync_write(void)
+{
+    bench_report("async", "sync_write", SENSOR_UPDATES * SENSOR_KEYS, write_updates());
+}
+
+static void bench_async_write(void)
+{
+    nvs_async_config_t config = NVS_ASYNC_CONFIG_DEFAULT();
+    config.queue_length = SENSOR_KEYS;
+    ESP_ERROR_CHECK(nvs_async_start(&config));
+
+    uint64_t elapsed = write_updates();
+    bench_report("async", "async_write", SENSOR_UPDATES * SENSOR_KEYS, elapsed);
+
+    // Including the time until everything is in flash; coalescing makes it less than one write per update
+    uint64_t start = bench_now_ns();
+    ESP_ERROR_CHECK(nvs_flush(10000));
+    bench_report("async", "async_write_flushed", SENSOR_UPDATES * SENSOR_KEYS, elapsed + bench_now_ns() - start);
+
+    ESP_ERROR_CHECK(nvs_async_stop());
+}
+
+void bench_async(void)
+{
+    bench_sync_write();
+    bench_async_write();
+}
@@ -0,0 +1,139 @@
+#include <stdio.h>
+
+#include "esp_check.h"
+#include "nvs.h"
+
+#include "bench_common.h"
+#include "non_volatile_storage.h"
+
+#define BOOT_NAMESPACES 6   // Number of namespaces read at boot
+#define BOOT_KEYS       20  // Number of values in each namespace
+
+static void boot_namespace(char *namespace, size_t size, uint32_t index)
+{
+    snprintf(namespace, size, "boot_%u", (unsigned)index);
+}
+
+static void boot_key(char *key, size_t size, uint32_t index)
+{
+    snprintf(key, size, "key_%02u", (unsigned)index);
+}
+
+// A mix of the types a configuration typically has: integers of all sizes and a few strings
+static void write_configuration(void)
+{
+    char namespace[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    for (uint32_t n = 0; n < BOOT_NAMESPACES; ++n) {
+        boot_namespace(namespace, sizeof(namespace), n);
+        for (uint32_t k = 0; k < BOOT_KEYS; ++k) {
+            boot_key(key, sizeof(key), k);
+            switch (k % 4) {
+                case 0:
+                    ESP_ERROR_CHECK(nvs_write_uint8(namespace, key, (uint8_t)k));
+                    break;
+                case 1:
+                    ESP_ERROR_CHECK(nvs_write_uint16(namespace, key, (uint16_t)k));
+                    break;
+                case 2:
+                    ESP_ERROR_CHECK(nvs_write_uint32(namespace, key, k));
+                    break;
+                default:
+                    ESP_ERROR_CHECK(nvs_write_string(namespace, key, "configuration string"));
+                    break;
+            }
+        }
+    }
+}
+
+// Start every case like a boot, without any open handle or cached value
+static void reboot(void)
+{
+    ESP_ERROR_CHECK(nvs_deinit());
+    ESP_ERROR_CHECK(nvs_init());
+}
+
+static void bench_per_key_read(void)
+{
+    char namespace[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    char string[32];
+    uint32_t value;
+
+    reboot();
+    uint64_t start = bench_now_ns();
+    for (uint32_t n = 0; n < BOOT_NAMESPACES; ++n) {
+        boot_namespace(namespace, sizeof(namespace), n);
+        for (uint32_t k = 0; k < BOOT_KEYS; ++k) {
+            boot_key(key, sizeof(key), k);
+            size_t length = sizeof(string);
+            switch (k % 4) {
+                case 0:
+                    ESP_ERROR_CHECK(nvs_read_uint8(namespace, key, &value));
+                    break;
+                case 1:
+                    ESP_ERROR_CHECK(nvs_read_uint16(namespace, key, &value));
+                    break;
+                case 2:
+                    ESP_ERROR_CHECK(nvs_read_uint32(namespace, key, &value));
+                    break;
+                default:
+                    ESP_ERROR_CHECK(nvs_read_string_into(namespace, key, string, &length));
+                    break;
+            }
+        }
+    }
+    bench_report("boot", "per_key_read", BOOT_NAMESPACES * BOOT_KEYS, bench_now_ns() - start);
+}
+
+static esp_err_t count_value(const char *key, nvs_type_t type, const void *value, size_t length, void *ctx)
+{
+    (void)key;
+    (void)type;
+    (void)value;
+    (void)length;
+    ++*(uint32_t*)ctx;
+    return ESP_OK;
+}
+
+static void bench_load_namespace(void)
+{
+    char namespace[NVS_KEY_NAME_MAX_SIZE];
+    uint32_t loaded = 0;
+
+    reboot();
+    uint64_t start = bench_now_ns();
+    for (uint32_t n = 0; n < BOOT_NAMESPACES; ++n) {
+        boot_namespace(namespace, sizeof(namespace), n);
+        ESP_ERROR_CHECK(nvs_load_namespace(namespace, count_value, &loaded));
+    }
+    bench_report("boot", "load_namespace", loaded, bench_now_ns() - start);
+}
+
+static void bench_snapshot(void)
+{
+    char namespace[NVS_KEY_NAME_MAX_SIZE];
+    nvs_snapshot_t snapshots[BOOT_NAMESPACES];
+    uint32_t loaded = 0;
+
+    reboot();
+    uint64_t start = bench_now_ns();
+    for (uint32_t n = 0; n < BOOT_NAMESPACES; ++n) {
+        boot_namespace(namespace, sizeof(namespace), n);
+        ESP_ERROR_CHECK(nvs_snapshot_load(namespace, &snapshots[n]));
+        loaded += snapshots[n].count;
+    }
+    bench_report("boot", "snapshot_load", loaded, bench_now_ns() - start);
+
+    for (uint32_t n = 0; n < BOOT_NAMESPACES; ++n) {
+        nvs_snapshot_free(&snapshots[n]);
+    }
+}
+
+void bench_boot(void)
+{
+    write_configuration();
+    bench_per_key_read();
+    bench_load_namespace();
+    bench_snapshot();
+}
@@ -0,0 +1,98 @@
+#include "bench_common.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+uint64_t bench_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+void bench_report(const char *suite, const char *name, uint32_t operations, uint64_t elapsed_ns)
+{
+    double ops_per_sec = (elapsed_ns > 0) ? (double)operations * 1e9 / (double)elapsed_ns : 0.0;
+    printf("{\"suite\":\"%s\",\"case\":\"%s\",\"ops\":%" PRIu32 ",\"total_ns\":%" PRIu64 ",\"ops_per_sec\":%.1f}\n",
+           suite, name, operations, elapsed_ns, ops_per_sec);
+}
+
+void bench_samples_init(bench_samples_t *samples, uint32_t capacity)
+{
+    samples->samples_ns = malloc(capacity * sizeof(samples->samples_ns[0]));
+    if (samples->samples_ns == NULL) {
+        printf("Failed to allocate %" PRIu32 " samples\n", capacity);
+        abort();
+    }
+    samples->count = 0;
+    samples->capacity = capacity;
+}
+
+void bench_samples_add(bench_samples_t *samples, uint64_t elapsed_ns)
+{
+    if (samples->count < samples->capacity) {
+        samples->samples_ns[samples->count++] = elapsed_ns;
+    }
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+    uint64_t left = *(const uint64_t*)a;
+    uint64_t right = *(const uint64_t*)b;
+    return (left > right) - (left < right);
+}
+
+// Nearest-rank percentile of sorted samples
+static uint64_t percentile(const bench_samples_t *samples, uint32_t percent)
+{
+    if (samples->count == 0) {
+        return 0;
+    }
+    uint32_t rank = (samples->count * percent + 99) / 100;
+    return samples->samples_ns[(rank > 0) ? rank - 1 : 0];
+}
+
+// "keys=16 mode=async" -> {"keys":16,"mode":"async"}
+static void print_params(const char *params)
+{
+    printf("{");
+    const char *pair = params;
+    while (pair != NULL && *pair != '\0') {
+        size_t length = strcspn(pair, " ");
+        const char *equals = memchr(pair, '=', length);
+        if (equals != NULL) {
+            int value_length = (int)(pair + length - equals - 1);
+            bool number = value_length > 0 && strspn(equals + 1, "0123456789") >= (size_t)value_length;
+            printf("%s\"%.*s\":%s%.*s%s", (pair == params) ? "" : ",", (int)(equals - pair), pair,
+                   number ? "" : "\"", value_length, equals + 1, number ? "" : "\"");
+        }
+        pair += length;
+        pair += strspn(pair, " ");
+    }
+    printf("}");
+}
+
+void bench_report_samples(const char *suite, const char *name, const char *params, bench_samples_t *samples)
+{
+    uint64_t total_ns = 0;
+    for (uint32_t i = 0; i < samples->count; ++i) {
+        total_ns += samples->samples_ns[i];
+    }
+    qsort(samples->samples_ns, samples->count, sizeof(samples->samples_ns[0]), compare_samples);
+
+    double ops_per_sec = (total_ns > 0) ? (double)samples->count * 1e9 / (double)total_ns : 0.0;
+    printf("{\"suite\":\"%s\",\"case\":\"%s\",\"params\":", suite, name);
+    print_params(params);
+    printf(",\"ops\":%" PRIu32 ",\"total_ns\":%" PRIu64 ",\"ops_per_sec\":%.1f,\"p50_ns\":%" PRIu64
+           ",\"p99_ns\":%" PRIu64 "}\n", samples->count, total_ns, ops_per_sec, percentile(samples, 50),
+           percentile(samples, 99));
+
+    free(samples->samples_ns);
+    samples->samples_ns = NULL;
+    samples->count = 0;
+    samples->capacity = 0;
+}
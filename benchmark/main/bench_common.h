@@ -0,0 +1,69 @@
+#ifndef BENCH_COMMON_H_
+#define BENCH_COMMON_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Monotonic host time in nanoseconds
+ */
+uint64_t bench_now_ns(void);
+
+/**
+ * @brief Print one benchmark result as a single JSON line on stdout
+ *
+ * @param[in] suite Name of the benchmark suite, for example "txn".
+ * @param[in] name Name of the case inside the suite.
+ * @param[in] operations Number of operations measured.
+ * @param[in] elapsed_ns Total time of all operations.
+ */
+void bench_report(const char *suite, const char *name, uint32_t operations, uint64_t elapsed_ns);
+
+/**
+ * @brief Latencies of single operations, for percentiles
+ */
+typedef struct {
+    uint64_t *samples_ns;
+    uint32_t count;
+    uint32_t capacity;
+} bench_samples_t;
+
+/**
+ * @brief Allocate room for the given number of samples, aborts if there is not enough memory
+ */
+void bench_samples_init(bench_samples_t *samples, uint32_t capacity);
+
+/**
+ * @brief Record the latency of one operation, samples beyond the capacity are dropped
+ */
+void bench_samples_add(bench_samples_t *samples, uint64_t elapsed_ns);
+
+/**
+ * @brief Print the samples as a single JSON line with ops/sec, p50 and p99, then free them
+ *
+ * @param[in] suite Name of the benchmark suite, for example "api".
+ * @param[in] name Name of the case inside the suite.
+ * @param[in] params Parameters of the case as "name=value" pairs separated by spaces, reported as a JSON object.
+ * @param[in] samples Latencies recorded by bench_samples_add().
+ */
+void bench_report_samples(const char *suite, const char *name, const char *params, bench_samples_t *samples);
+
+void bench_txn(void);
+void bench_logging(void);
+void bench_async(void);
+void bench_boot(void);
+void bench_api(void);
+void bench_counter(void);
+void bench_compress(void);
+void bench_concurrency(void);
+void bench_maintenance(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // BENCH_COMMON_H_
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_check.h"
+#include "nvs.h"
+
+#include "bench_common.h"
+#include "non_volatile_storage.h"
+
+#define COMPRESS_ITERATIONS 200   // Measured writes and reads per case
+#define COMPRESS_MAX_SIZE   4000  // Largest blob
+
+static const char *NAMESPACE = "bench_compress";
+
+typedef void (*fill_t)(uint8_t *blob, size_t size, uint32_t iteration);
+
+typedef struct {
+    const char *name;
+    fill_t fill;
+} compress_data_t;
+
+// Calibration table: 16-bit points of a curve quantized into steps of 8 points
+static void fill_table(uint8_t *blob, size_t size, uint32_t iteration)
+{
+    for (size_t i = 0; i + 1 < size; i += 2) {
+        uint16_t point = (uint16_t)(1000 + (i / 16) * 3 + iteration % 4);
+        memcpy(blob + i, &point, sizeof(point));
+    }
+    if (size % 2 != 0) {
+        blob[size - 1] = 0;
+    }
+}
+
+// PEM certificate: header line and base64 lines
+static void fill_certificate(uint8_t *blob, size_t size, uint32_t iteration)
+{
+    static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    static const char HEADER[] = "-----BEGIN CERTIFICATE-----\n";
+    uint32_t state = 12345 + iteration;
+    for (size_t i = 0; i < size; ++i) {
+        if (i < sizeof(HEADER) - 1) {
+            blob[i] = (uint8_t)HEADER[i];
+        } else if ((i - (sizeof(HEADER) - 1)) % 65 == 64) {
+            blob[i] = '\n';
+        } else {
+            state = state * 1103515245 + 12345;
+            blob[i] = (uint8_t)ALPHABET[(state >> 16) % 64];
+        }
+    }
+}
+
+// Device configuration as JSON text
+static void fill_json(uint8_t *blob, size_t size, uint32_t iteration)
+{
+    size_t length = 0;
+    for (uint32_t entry = 0; length < size; ++entry) {
+        char line[64];
+        int line_length = snprintf(line, sizeof(line), "{\"channel\":%u,\"gain\":%u,\"offset\":-%u,\"on\":true},\n",
+                                   (unsigned)entry, (unsigned)((entry * 7 + iteration) % 100),
+                                   (unsigned)(entry % 13));
+        size_t copied = (size - length < (size_t)line_length) ? size - length : (size_t)line_length;
+        memcpy(blob + length, line, copied);
+        length += copied;
+    }
+}
+
+// Already compressed or encrypted content
+static void fill_random(uint8_t *blob, size_t size, uint32_t iteration)
+{
+    uint32_t state = 777 + iteration;
+    for (size_t i = 0; i < size; ++i) {
+        state = state * 1103515245 + 12345;
+        blob[i] = (uint8_t)(state >> 16);
+    }
+}
+
+static const compress_data_t DATA[] = {
+    { "table", fill_table },
+    { "json", fill_json },
+    { "certificate", fill_certificate },
+    { "random", fill_random },
+};
+
+static const size_t SIZES[] = { 256, 1024, COMPRESS_MAX_SIZE };
+
+static uint8_t blob[COMPRESS_MAX_SIZE];
+static uint8_t read_blob[COMPRESS_MAX_SIZE];
+
+static size_t stored_size(const char *key)
+{
+    nvs_handle_t nvs_handle;
+    size_t length = 0;
+    ESP_ERROR_CHECK(nvs_open(NAMESPACE, NVS_READONLY, &nvs_handle));
+    ESP_ERROR_CHECK(nvs_get_blob(nvs_handle, key, NULL, &length));
+    nvs_close(nvs_handle);
+    return length;
+}
+
+static void bench_case(const compress_data_t *data, size_t size, bool compressed)
+{
+    const char *mode = compressed ? "compressed" : "raw";
+    bench_samples_t write_samples;
+    bench_samples_t read_samples;
+    bench_samples_init(&write_samples, COMPRESS_ITERATIONS);
+    bench_samples_init(&read_samples, COMPRESS_ITERATIONS);
+
+    for (uint32_t i = 0; i < COMPRESS_ITERATIONS; ++i) {
+        data->fill(blob, size, i);
+        uint64_t start = bench_now_ns();
+        if (compressed) {
+            ESP_ERROR_CHECK(nvs_write_blob_compressed(NAMESPACE, mode, blob, size));
+        } else {
+            ESP_ERROR_CHECK(nvs_write_blob(NAMESPACE, mode, blob, size));
+        }
+        bench_samples_add(&write_samples, bench_now_ns() - start);
+
+        start = bench_now_ns();
+        ESP_ERROR_CHECK(nvs_read_blob(NAMESPACE, mode, read_blob, sizeof(read_blob)));
+        bench_samples_add(&read_samples, bench_now_ns() - start);
+        if (memcmp(blob, read_blob, size) != 0) {
+            printf("Blob %s read back differs\n", mode);
+            abort();
+        }
+    }
+
+    // stored is the size in flash, so stored versus size is the saving the CPU time above buys
+    char params[96];
+    snprintf(params, sizeof(params), "data=%s mode=%s size=%u stored=%u", data->name, mode, (unsigned)size,
+             (unsigned)stored_size(mode));
+    bench_report_samples("compress", "write_blob", params, &write_samples);
+    bench_report_samples("compress", "read_blob", params, &read_samples);
+}
+
+void bench_compress(void)
+{
+    for (size_t d = 0; d < sizeof(DATA) / sizeof(DATA[0]); ++d) {
+        for (size_t s = 0; s < sizeof(SIZES) / sizeof(SIZES[0]); ++s) {
+            bench_case(&DATA[d], SIZES[s], false);
+            bench_case(&DATA[d], SIZES[s], true);
+        }
+    }
+    ESP_ERROR_CHECK(nvs_erase_namespace(NAMESPACE));
+}
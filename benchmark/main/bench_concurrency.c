@@ -0,0 +1,243 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_check.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+
+#include "bench_common.h"
+#include "non_volatile_storage.h"
+
+#define READER_TASKS    3    // Each reads its own namespace
+#define READER_KEYS     8
+#define READER_READS    100  // Reads per reader task, one per tick
+#define WRITER_TXN_KEYS 32   // Strings per transaction of the writer task
+#define STRESS_TASKS    12   // More namespaces than the handle cache holds
+#define STRESS_ROUNDS   200
+#define STRESS_KEYS     4    // Own keys of every stress task, in its namespace and in the shared one
+#define TASK_STACK      4096
+
+#define TASK_BIT(index) ((EventBits_t)1 << (index))
+
+static const char *WRITER_NAMESPACE = "bench_conc_w";
+static const char *SHARED_NAMESPACE = "bench_conc_s";
+
+typedef struct {
+    uint32_t index;
+    EventGroupHandle_t done;
+    bench_samples_t samples;
+    uint32_t mismatches;    // Reads which didn't return the last written value
+    uint32_t transactions;  // Committed by the writer task
+} conc_task_t;
+
+static void conc_namespace(char *namespace, size_t size, uint32_t index)
+{
+    snprintf(namespace, size, "bench_conc_%02u", (unsigned)index);
+}
+
+static void conc_key(char *key, size_t size, uint32_t task, uint32_t index)
+{
+    snprintf(key, size, "key_%02u_%02u", (unsigned)task, (unsigned)index);
+}
+
+static uint32_t reader_value(uint32_t task, uint32_t key)
+{
+    return task * 1000 + key;
+}
+
+static void prepare_readers(void)
+{
+    char namespace[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    for (uint32_t task = 0; task < READER_TASKS; ++task) {
+        conc_namespace(namespace, sizeof(namespace), task);
+        for (uint32_t k = 0; k < READER_KEYS; ++k) {
+            conc_key(key, sizeof(key), task, k);
+            ESP_ERROR_CHECK(nvs_write_uint32(namespace, key, reader_value(task, k)));
+        }
+    }
+}
+
+static void reader_task(void *arg)
+{
+    conc_task_t *task = arg;
+    char namespace[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    conc_namespace(namespace, sizeof(namespace), task->index);
+
+    for (uint32_t i = 0; i < READER_READS; ++i) {
+        uint32_t value = 0;
+        conc_key(key, sizeof(key), task->index, i % READER_KEYS);
+        uint64_t start = bench_now_ns();
+        esp_err_t result = nvs_read_uint32(namespace, key, &value);
+        bench_samples_add(&task->samples, bench_now_ns() - start);
+        if (result != ESP_OK || value != reader_value(task->index, i % READER_KEYS)) {
+            ++task->mismatches;
+        }
+        vTaskDelay(1);
+    }
+    xEventGroupSetBits(task->done, TASK_BIT(task->index));
+    vTaskDelete(NULL);
+}
+
+// Commits large transactions to its own namespace until every reader is done
+static void writer_task(void *arg)
+{
+    conc_task_t *task = arg;
+    const EventBits_t readers = TASK_BIT(READER_TASKS) - 1;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    char value[64];
+
+    for (uint32_t round = 0; (xEventGroupGetBits(task->done) & readers) != readers; ++round) {
+        nvs_txn_t txn;
+        ESP_ERROR_CHECK(nvs_txn_begin(WRITER_NAMESPACE, &txn));
+        for (uint32_t k = 0; k < WRITER_TXN_KEYS; ++k) {
+            conc_key(key, sizeof(key), READER_TASKS, k);
+            snprintf(value, sizeof(value), "round %u key %u", (unsigned)round, (unsigned)k);
+            ESP_ERROR_CHECK(nvs_txn_set_string(&txn, key, value));
+        }
+        ESP_ERROR_CHECK(nvs_txn_commit(&txn));
+        ++task->transactions;
+    }
+    xEventGroupSetBits(task->done, TASK_BIT(READER_TASKS));
+    vTaskDelete(NULL);
+}
+
+// Reader latency of unrelated namespaces, alone and while another task commits transactions
+static void run_reader_case(const char *name, bool with_writer)
+{
+    conc_task_t tasks[READER_TASKS + 1] = { 0 };
+    EventGroupHandle_t done = xEventGroupCreate();
+    EventBits_t all = TASK_BIT(READER_TASKS) - 1;
+
+    if (with_writer) {
+        tasks[READER_TASKS].index = READER_TASKS;
+        tasks[READER_TASKS].done = done;
+        xTaskCreate(writer_task, "bench_writer", TASK_STACK, &tasks[READER_TASKS], 5, NULL);
+        all |= TASK_BIT(READER_TASKS);
+    }
+    for (uint32_t i = 0; i < READER_TASKS; ++i) {
+        tasks[i].index = i;
+        tasks[i].done = done;
+        bench_samples_init(&tasks[i].samples, READER_READS);
+        xTaskCreate(reader_task, "bench_reader", TASK_STACK, &tasks[i], 5, NULL);
+    }
+    xEventGroupWaitBits(done, all, pdTRUE, pdTRUE, portMAX_DELAY);
+    vEventGroupDelete(done);
+
+    bench_samples_t samples;
+    bench_samples_init(&samples, READER_TASKS * READER_READS);
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < READER_TASKS; ++i) {
+        for (uint32_t s = 0; s < tasks[i].samples.count; ++s) {
+            bench_samples_add(&samples, tasks[i].samples.samples_ns[s]);
+        }
+        free(tasks[i].samples.samples_ns);
+        mismatches += tasks[i].mismatches;
+    }
+    if (mismatches > 0) {
+        printf("concurrency/%s: %u reads returned a wrong value\n", name, (unsigned)mismatches);
+        abort();
+    }
+
+    char description[64];
+    snprintf(description, sizeof(description), "tasks=%u writer_txns=%u", (unsigned)READER_TASKS,
+             (unsigned)tasks[READER_TASKS].transactions);
+    bench_report_samples("concurrency", name, description, &samples);
+}
+
+// Every task writes, reads back and erases its own keys in its own namespace and in one shared namespace, and
+// sometimes commits a transaction; another task never touches these keys, so every read must see the last write
+static void stress_task(void *arg)
+{
+    conc_task_t *task = arg;
+    char namespace[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    conc_namespace(namespace, sizeof(namespace), READER_TASKS + task->index);
+
+    for (uint32_t round = 0; round < STRESS_ROUNDS; ++round) {
+        const char *target = (round % 2 == 0) ? namespace : SHARED_NAMESPACE;
+        uint32_t k = round % STRESS_KEYS;
+        uint32_t expected = task->index << 16 | round;
+        uint32_t value = 0;
+        conc_key(key, sizeof(key), task->index, k);
+        uint64_t start = bench_now_ns();
+
+        if (round % 8 == 7) {
+            nvs_txn_t txn;
+            ESP_ERROR_CHECK(nvs_txn_begin(target, &txn));
+            ESP_ERROR_CHECK(nvs_txn_set_uint32(&txn, key, expected));
+            ESP_ERROR_CHECK(nvs_txn_commit(&txn));
+        } else {
+            ESP_ERROR_CHECK(nvs_write_uint32(target, key, expected));
+        }
+        if (nvs_read_uint32(target, key, &value) != ESP_OK || value != expected) {
+            ++task->mismatches;
+        }
+        if (round % 16 == 15) {
+            ESP_ERROR_CHECK(nvs_erase_value(target, key));
+            if (nvs_key_exists(target, key, NULL, NULL) != ESP_ERR_NVS_NOT_FOUND) {
+                ++task->mismatches;
+            }
+        }
+        bench_samples_add(&task->samples, bench_now_ns() - start);
+    }
+    xEventGroupSetBits(task->done, TASK_BIT(task->index));
+    vTaskDelete(NULL);
+}
+
+static void run_stress_case(void)
+{
+    static conc_task_t tasks[STRESS_TASKS];
+    EventGroupHandle_t done = xEventGroupCreate();
+
+    for (uint32_t i = 0; i < STRESS_TASKS; ++i) {
+        tasks[i] = (conc_task_t){ .index = i, .done = done };
+        bench_samples_init(&tasks[i].samples, STRESS_ROUNDS);
+        xTaskCreate(stress_task, "bench_stress", TASK_STACK, &tasks[i], 5, NULL);
+    }
+    xEventGroupWaitBits(done, TASK_BIT(STRESS_TASKS) - 1, pdTRUE, pdTRUE, portMAX_DELAY);
+    vEventGroupDelete(done);
+
+    bench_samples_t samples;
+    bench_samples_init(&samples, STRESS_TASKS * STRESS_ROUNDS);
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < STRESS_TASKS; ++i) {
+        for (uint32_t s = 0; s < tasks[i].samples.count; ++s) {
+            bench_samples_add(&samples, tasks[i].samples.samples_ns[s]);
+        }
+        free(tasks[i].samples.samples_ns);
+        mismatches += tasks[i].mismatches;
+    }
+    if (mismatches > 0) {
+        printf("concurrency/stress_mixed: %u operations saw a wrong value\n", (unsigned)mismatches);
+        abort();
+    }
+
+    char description[32];
+    snprintf(description, sizeof(description), "tasks=%u", (unsigned)STRESS_TASKS);
+    bench_report_samples("concurrency", "stress_mixed", description, &samples);
+}
+
+static void erase_namespaces(void)
+{
+    char namespace[NVS_KEY_NAME_MAX_SIZE];
+    for (uint32_t i = 0; i < READER_TASKS + STRESS_TASKS; ++i) {
+        conc_namespace(namespace, sizeof(namespace), i);
+        ESP_ERROR_CHECK(nvs_erase_namespace(namespace));
+    }
+    ESP_ERROR_CHECK(nvs_erase_namespace(WRITER_NAMESPACE));
+    ESP_ERROR_CHECK(nvs_erase_namespace(SHARED_NAMESPACE));
+}
+
+void bench_concurrency(void)
+{
+    prepare_readers();
+    run_reader_case("reader_idle", false);
+    run_reader_case("reader_during_commit", true);
+    run_stress_case();
+    erase_namespaces();
+}
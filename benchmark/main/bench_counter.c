@@ -0,0 +1,51 @@
+#include <stdint.h>
+
+#include "esp_check.h"
+
+#include "bench_common.h"
+#include "non_volatile_storage.h"
+
+#define COUNTER_EVENTS 1000  // Number of increments of the event counter
+
+static const char *NAMESPACE = "bench_counter";
+
+// What applications did before: a read and a committed write per event
+static void bench_read_modify_write(void)
+{
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < COUNTER_EVENTS; ++i) {
+        uint32_t events = 0;
+        esp_err_t err = nvs_read_uint32(NAMESPACE, "rmw_events", &events);
+        if (err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_ERROR_CHECK(err);
+        }
+        ESP_ERROR_CHECK(nvs_write_uint32(NAMESPACE, "rmw_events", events + 1));
+    }
+    bench_report("counter", "read_modify_write", COUNTER_EVENTS, bench_now_ns() - start);
+}
+
+static void bench_counter_add(void)
+{
+    ESP_ERROR_CHECK(nvs_counter_configure(0, 100));  // Written every 100 events
+
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < COUNTER_EVENTS; ++i) {
+        ESP_ERROR_CHECK(nvs_counter_add(NAMESPACE, "events", 1));
+    }
+    bench_report("counter", "counter_add", COUNTER_EVENTS, bench_now_ns() - start);
+
+    uint64_t events;
+    start = bench_now_ns();
+    for (uint32_t i = 0; i < COUNTER_EVENTS; ++i) {
+        ESP_ERROR_CHECK(nvs_counter_get(NAMESPACE, "events", &events));
+    }
+    bench_report("counter", "counter_get", COUNTER_EVENTS, bench_now_ns() - start);
+
+    ESP_ERROR_CHECK(nvs_counter_flush());
+}
+
+void bench_counter(void)
+{
+    bench_read_modify_write();
+    bench_counter_add();
+}
@@ -0,0 +1,79 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // asprintf()
+#endif
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_check.h"
+#include "esp_log.h"
+
+#include "bench_common.h"
+#include "non_volatile_storage.h"
+
+#define LOGGING_ITERATIONS 20000
+
+static const char *NAMESPACE = "bench_log";
+static const char *LIBRARY_TAG = "non_volatile_storage";
+
+static volatile size_t sink;  // Keeps the compiler from dropping the formatted strings
+
+static int discard_vprintf(const char *format, va_list args)
+{
+    (void)format;
+    (void)args;
+    return 0;
+}
+
+// How the library formatted values for logging before: a heap allocation per call
+static void bench_format_heap(void)
+{
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < LOGGING_ITERATIONS; ++i) {
+        char *string = NULL;
+        if (asprintf(&string, "%" PRIu32, i) != -1) {
+            sink += (size_t)string[0];
+            free(string);
+        }
+    }
+    bench_report("logging", "format_heap", LOGGING_ITERATIONS, bench_now_ns() - start);
+}
+
+// How the library formats values now: a fixed stack buffer
+static void bench_format_stack(void)
+{
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < LOGGING_ITERATIONS; ++i) {
+        char string[24];
+        snprintf(string, sizeof(string), "%" PRIu32, i);
+        sink += (size_t)string[0];
+    }
+    bench_report("logging", "format_stack", LOGGING_ITERATIONS, bench_now_ns() - start);
+}
+
+static void bench_read(const char *name, esp_log_level_t level)
+{
+    uint32_t value;
+    esp_log_level_set(LIBRARY_TAG, level);
+    uint64_t start = bench_now_ns();
+    for (uint32_t i = 0; i < LOGGING_ITERATIONS; ++i) {
+        ESP_ERROR_CHECK(nvs_read_uint32(NAMESPACE, "value", &value));
+    }
+    bench_report("logging", name, LOGGING_ITERATIONS, bench_now_ns() - start);
+}
+
+void bench_logging(void)
+{
+    bench_format_heap();
+    bench_format_stack();
+
+    // Log messages are formatted but discarded, so only the cost of the logging path is measured and not the console
+    ESP_ERROR_CHECK(nvs_write_uint32(NAMESPACE, "value", 123456789));
+    vprintf_like_t previous_vprintf = esp_log_set_vprintf(discard_vprintf);
+    bench_read("read_uint32_log_info", ESP_LOG_INFO);
+    bench_read("read_uint32_log_error", ESP_LOG_ERROR);
+    esp_log_set_vprintf(previous_vprintf);
+    esp_log_level_set(LIBRARY_TAG, CONFIG_LOG_DEFAULT_LEVEL);
+}
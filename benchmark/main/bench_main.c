@@ -0,0 +1,27 @@
+#include <stdio.h>
+
+#include "esp_check.h"
+#include "nvs_flash.h"
+
+#include "bench_common.h"
+#include "non_volatile_storage.h"
+
+void app_main(void)
+{
+    // Start every run from an empty emulated partition
+    ESP_ERROR_CHECK(nvs_flash_erase());
+    ESP_ERROR_CHECK(nvs_init());
+
+    bench_txn();
+    bench_logging();
+    bench_async();
+    bench_boot();
+    bench_api();
+    bench_counter();
+    bench_compress();
+    bench_concurrency();
+    bench_maintenance();
+
+    ESP_ERROR_CHECK(nvs_deinit());
+    fflush(stdout);
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_check.h"
+#include "nvs.h"
+
+#include "bench_common.h"
+#include "non_volatile_storage.h"
+
+#define COLD_BLOB_SIZE  1000  // Size of the blobs which fill the partition and are never written again
+#define COLD_FILL       80    // Percent of the partition's entries used by them
+#define CONTROL_KEYS    4     // Status strings rewritten round-robin by the control loop
+#define CONTROL_SIZE    96    // Size of a status string including the terminator
+#define CONTROL_WRITES  2000
+#define CONTROL_BURST   25    // Writes between two idle moments
+
+static const char *COLD_NAMESPACE = "bench_cold";
+static const char *CONTROL_NAMESPACE = "bench_ctrl";
+
+static void fill_cold(uint32_t percent)
+{
+    static uint8_t blob[COLD_BLOB_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_stats_t stats;
+    ESP_ERROR_CHECK(nvs_get_stats(NULL, &stats));
+    for (uint32_t i = 0; stats.used_entries * 100 < stats.total_entries * percent; ++i) {
+        snprintf(key, sizeof(key), "cold_%u", (unsigned)i);
+        ESP_ERROR_CHECK(nvs_write_blob(COLD_NAMESPACE, key, blob, sizeof(blob)));
+        ESP_ERROR_CHECK(nvs_get_stats(NULL, &stats));
+    }
+}
+
+// A control loop rewriting its status, with an idle moment after every burst which runs the maintenance or not
+static void run_control_loop(bool maintained)
+{
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    char status[CONTROL_SIZE];
+    nvs_maintenance_config_t config = NVS_MAINTENANCE_CONFIG_DEFAULT();
+
+    uint32_t passes = 0;
+    uint64_t maintenance_ns = 0;
+    bench_samples_t samples;
+    bench_samples_init(&samples, CONTROL_WRITES);
+    for (uint32_t i = 0; i < CONTROL_WRITES; ++i) {
+        snprintf(key, sizeof(key), "status_%u", (unsigned)(i % CONTROL_KEYS));
+        memset(status, 'a' + i % 26, sizeof(status) - 1);
+        status[sizeof(status) - 1] = '\0';
+        uint64_t start = bench_now_ns();
+        ESP_ERROR_CHECK(nvs_write_string(CONTROL_NAMESPACE, key, status));
+        bench_samples_add(&samples, bench_now_ns() - start);
+
+        if (maintained && i % CONTROL_BURST == CONTROL_BURST - 1) {
+            bool worked = false;
+            start = bench_now_ns();
+            ESP_ERROR_CHECK(nvs_maintenance_run(&config, &worked));
+            if (worked) {
+                maintenance_ns += bench_now_ns() - start;
+                ++passes;
+            }
+        }
+    }
+
+    char description[64];
+    snprintf(description, sizeof(description), "maintenance=%s fill=%u value_size=%u", maintained ? "on" : "off",
+             (unsigned)COLD_FILL, (unsigned)CONTROL_SIZE);
+    bench_report_samples("maintenance", "control_write", description, &samples);
+    if (maintained) {
+        bench_report("maintenance", "idle_pass", passes, maintenance_ns);
+    }
+    ESP_ERROR_CHECK(nvs_erase_namespace(CONTROL_NAMESPACE));
+}
+
+void bench_maintenance(void)
+{
+    fill_cold(COLD_FILL);
+    run_control_loop(false);
+    run_control_loop(true);
+    ESP_ERROR_CHECK(nvs_erase_namespace(COLD_NAMESPACE));
+}
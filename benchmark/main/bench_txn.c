@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_check.h"
+
+#include "bench_common.h"
+#include "non_volatile_storage.h"
+
+#define PROFILE_FIELDS 30  // Number of values in one device profile
+#define PROFILE_SAVES  50  // How many times the whole profile is saved
+
+static const char *NAMESPACE = "bench_txn";
+
+static void profile_key(char *key, size_t size, uint32_t field)
+{
+    snprintf(key, size, "field_%02u", (unsigned)field);
+}
+
+static void bench_per_key_commit(void)
+{
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint64_t start = bench_now_ns();
+    for (uint32_t save = 0; save < PROFILE_SAVES; ++save) {
+        for (uint32_t field = 0; field < PROFILE_FIELDS; ++field) {
+            profile_key(key, sizeof(key), field);
+            ESP_ERROR_CHECK(nvs_write_uint32(NAMESPACE, key, save * PROFILE_FIELDS + field));
+        }
+    }
+    bench_report("txn", "per_key_commit", PROFILE_SAVES * PROFILE_FIELDS, bench_now_ns() - start);
+}
+
+static void bench_batched_commit(void)
+{
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint64_t start = bench_now_ns();
+    for (uint32_t save = 0; save < PROFILE_SAVES; ++save) {
+        nvs_txn_t txn;
+        ESP_ERROR_CHECK(nvs_txn_begin(NAMESPACE, &txn));
+        for (uint32_t field = 0; field < PROFILE_FIELDS; ++field) {
+            profile_key(key, sizeof(key), field);
+            ESP_ERROR_CHECK(nvs_txn_set_uint32(&txn, key, save * PROFILE_FIELDS + field));
+        }
+        ESP_ERROR_CHECK(nvs_txn_commit(&txn));
+    }
+    bench_report("txn", "batched_commit", PROFILE_SAVES * PROFILE_FIELDS, bench_now_ns() - start);
+}
+
+// A profile field cleared to an empty blob, which the transaction has to copy without a zero-sized allocation
+static void bench_empty_blob_commit(void)
+{
+    uint64_t start = bench_now_ns();
+    for (uint32_t save = 0; save < PROFILE_SAVES; ++save) {
+        nvs_txn_t txn;
+        ESP_ERROR_CHECK(nvs_txn_begin(NAMESPACE, &txn));
+        ESP_ERROR_CHECK(nvs_txn_set_uint32(&txn, "field_00", save));
+        ESP_ERROR_CHECK(nvs_txn_set_blob(&txn, "empty", "", 0));
+        ESP_ERROR_CHECK(nvs_txn_commit(&txn));
+    }
+    bench_report("txn", "empty_blob_commit", PROFILE_SAVES, bench_now_ns() - start);
+
+    size_t length;
+    ESP_ERROR_CHECK(nvs_blob_size(NAMESPACE, "empty", &length));
+    if (length != 0) {
+        printf("Empty blob read back with %u bytes\n", (unsigned)length);
+        abort();
+    }
+}
+
+void bench_txn(void)
+{
+    bench_per_key_commit();
+    bench_batched_commit();
+    bench_empty_blob_commit();
+}
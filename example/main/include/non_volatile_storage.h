@@ -25,7 +25,12 @@
 #ifndef NON_VOLATILE_STORAGE_H_
 #define NON_VOLATILE_STORAGE_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #include "esp_err.h"
+#include "nvs.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -46,10 +51,40 @@ extern "C" {
  */
 esp_err_t nvs_init(void);
 
+/**
+ * @brief Close all cached namespace handles and deinitialize the default NVS partition
+ *
+ * Namespace handles are opened on the first access and then kept in a small LRU cache (see NVS_HANDLE_CACHE_SIZE),
+ * so repeated reads and writes do not pay for nvs_open()/nvs_close() every time.
+ *
+ * @return
+ *         - ESP_OK on success.
+ *         - ESP_ERR_NOT_FOUND if the partition was not initialized.
+ */
+esp_err_t nvs_deinit(void);
+
+/**
+ * @brief Erase a single key, or all keys of a namespace
+ *
+ * nvs_erase_namespace() also drops every cached handle of the namespace.
+ *
+ * @param[in] namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in] key Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @return
+ *         - ESP_OK if erase operation was successful.
+ *         - ESP_ERR_NVS_NOT_FOUND if the requested key doesn’t exist.
+ *         - ESP_ERR_NVS_READ_ONLY if handle was opened as read only.
+ *         - other error codes from the underlying storage driver.
+ */
+esp_err_t nvs_erase_value(const char *namespace_name, const char *key);
+esp_err_t nvs_erase_namespace(const char *namespace_name);
+
 /**
  * @brief Write int8_t, uint8, int16... value for given key
  *
- * @param[in] namespace Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * While the write queue is running (see nvs_async_start()), the value is only queued and ESP_OK means it was queued.
+ *
+ * @param[in] namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
  * @param[in] key Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
  * @param[in] value The value to set.
  * @return
@@ -60,24 +95,88 @@ esp_err_t nvs_init(void);
  *         - ESP_ERR_NVS_INVALID_NAME if key name doesn’t satisfy constraints.
  *         - ESP_ERR_NVS_NOT_ENOUGH_SPACE if there is not enough space in the underlying storage to save the value.
  *         - ESP_ERR_NVS_REMOVE_FAILED if the value wasn’t updated because flash write operation has failed. The value was written however, and update will be finished after re-initialization of nvs, provided that flash operation doesn’t fail again.
+ *         - ESP_ERR_TIMEOUT or ESP_ERR_NO_MEM if the write queue is full, depending on its backpressure policy.
+ */
+esp_err_t nvs_write_int8(const char *namespace_name, const char *key, int8_t value);
+esp_err_t nvs_write_uint8(const char *namespace_name, const char *key, uint8_t value);
+esp_err_t nvs_write_int16(const char *namespace_name, const char *key, int16_t value);
+esp_err_t nvs_write_uint16(const char *namespace_name, const char *key, uint16_t value);
+esp_err_t nvs_write_int32(const char *namespace_name, const char *key, int32_t value);
+esp_err_t nvs_write_uint32(const char *namespace_name, const char *key, uint32_t value);
+esp_err_t nvs_write_int64(const char *namespace_name, const char *key, int64_t value);
+esp_err_t nvs_write_uint64(const char *namespace_name, const char *key, uint64_t value);
+esp_err_t nvs_write_string(const char *namespace_name, const char *key, const char *value);
+esp_err_t nvs_write_float(const char *namespace_name, const char *key, float value);
+esp_err_t nvs_write_double(const char *namespace_name, const char *key, double value);
+esp_err_t nvs_write_blob(const char *namespace_name, const char *key, const void *value, size_t length);
+
+/**
+ * @brief Write a blob compressed, for large blobs with repeated content (tables, certificates, text)
+ *
+ * The blob is stored with a small header recording the codec and its original length, followed by an LZ4-style
+ * stream. If compression doesn't make it smaller, or the blob is shorter than NVS_COMPRESS_MIN_SIZE, it is stored raw.
+ * nvs_read_blob(), nvs_read_multi() and the blob readers decompress it transparently, nvs_blob_size() returns its
+ * original length; the buffer passed to a read must hold the original length. The blob is decompressed in place in
+ * that buffer, so a read allocates nothing and reads of different blobs don't wait for each other; a stream which
+ * couldn't be decompressed in place is stored raw. nvs_key_read(), snapshots, nvs_load_namespace() and
+ * nvs_struct_load() return the blob as stored. The compressor needs a buffer of the blob's length and a table of
+ * 2^NVS_COMPRESS_HASH_BITS entries, both from the heap.
+ *
+ * @param[in] namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in] key Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in] value The blob to write.
+ * @param[in] length Length of the blob in bytes.
+ * @return
+ *         - ESP_OK if the blob was written.
+ *         - ESP_ERR_NO_MEM if the compressor's buffers can't be allocated.
+ *         - Error codes of nvs_write_blob() otherwise.
  */
-esp_err_t nvs_write_int8(const char *namespace, const char *key, int8_t value);
-esp_err_t nvs_write_uint8(const char *namespace, const char *key, uint8_t value);
-esp_err_t nvs_write_int16(const char *namespace, const char *key, int16_t value);
-esp_err_t nvs_write_uint16(const char *namespace, const char *key, uint16_t value);
-esp_err_t nvs_write_int32(const char *namespace, const char *key, int32_t value);
-esp_err_t nvs_write_uint32(const char *namespace, const char *key, uint32_t value);
-esp_err_t nvs_write_int64(const char *namespace, const char *key, int64_t value);
-esp_err_t nvs_write_uint64(const char *namespace, const char *key, uint64_t value);
-esp_err_t nvs_write_string(const char *namespace, const char *key, const char *value);
-esp_err_t nvs_write_float(const char *namespace, const char *key, float value);
-esp_err_t nvs_write_double(const char *namespace, const char *key, double value);
-esp_err_t nvs_write_blob(const char *namespace, const char *key, const void *value, size_t length);
+esp_err_t nvs_write_blob_compressed(const char *namespace_name, const char *key, const void *value, size_t length);
+
+/**
+ * @brief Status of nvs_write_if_changed(): the stored value is the same, nothing was written
+ */
+#define NVS_WRITE_UNCHANGED (ESP_ERR_NVS_BASE + 0xFF)
+
+/**
+ * @brief Skip writes of values which are already stored
+ *
+ * When enabled, every nvs_write_*() and nvs_txn_commit() compares the new value with the stored one first and
+ * writes and commits only if it differs. Skipped writes return ESP_OK. Integers are compared with the stored value,
+ * strings and blobs with a hash of the last value written or read (see NVS_WRITE_HASH_CACHE_SIZE) or, if there is
+ * none, with the stored content. Disabled by default.
+ *
+ * @param[in] enable true to compare before every write.
+ */
+void nvs_set_skip_unchanged(bool enable);
+
+/**
+ * @brief Write a value only if it differs from the stored one
+ *
+ * The same as nvs_write_*() with nvs_set_skip_unchanged() enabled, but reports a skipped write as NVS_WRITE_UNCHANGED.
+ *
+ * @param[in] namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in] key Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in] type_value Type of the value: NVS_TYPE_I8...NVS_TYPE_U64, NVS_TYPE_STR or NVS_TYPE_BLOB.
+ * @param[in] value Pointer to the value of the given type, or to the zero-terminated string.
+ * @param[in] length Length of the blob, ignored for other types.
+ * @return
+ *         - ESP_OK if the value was written.
+ *         - NVS_WRITE_UNCHANGED if the stored value is the same and nothing was written.
+ *         - Error codes of nvs_write_*() otherwise.
+ */
+esp_err_t nvs_write_if_changed(const char *namespace_name, const char *key, nvs_type_t type_value,
+                               const void *value, size_t length);
+
+/**
+ * @brief Get the number of writes skipped because the value was unchanged
+ */
+uint32_t nvs_get_elided_writes(void);
 
 /**
  * @brief Read int8_t, uint8, int16... value for given key
  *
- * @param[in]  namespace Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in]  namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
  * @param[in]  key Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
  * @param[out] out_value Pointer to the output value. May be NULL for nvs_get_str and nvs_get_blob, in this case required length will be returned in length argument.
  * @return
@@ -88,20 +187,135 @@ esp_err_t nvs_write_blob(const char *namespace, const char *key, const void *val
  *         - ESP_ERR_NVS_INVALID_NAME if key name doesn’t satisfy constraints.
  *         - ESP_ERR_NVS_INVALID_LENGTH if length is not sufficient to store data.
  */
-esp_err_t nvs_read_int8(const char *namespace, const char *key, void *out_value);
-esp_err_t nvs_read_uint8(const char *namespace, const char *key, void *out_value);
-esp_err_t nvs_read_int16(const char *namespace, const char *key, void *out_value);
-esp_err_t nvs_read_uint16(const char *namespace, const char *key, void *out_value);
-esp_err_t nvs_read_int32(const char *namespace, const char *key, void *out_value);
-esp_err_t nvs_read_uint32(const char *namespace, const char *key, void *out_value);
-esp_err_t nvs_read_int64(const char *namespace, const char *key, void *out_value);
-esp_err_t nvs_read_uint64(const char *namespace, const char *key, void *out_value);
-esp_err_t nvs_read_string(const char *namespace, const char *key, void *out_value);  // Please see an example below.
-esp_err_t nvs_read_float(const char *namespace, const char *key, void *out_value);
-esp_err_t nvs_read_double(const char *namespace, const char *key, void *out_value);
-esp_err_t nvs_read_blob(const char *namespace, const char *key, void *out_value, size_t length);
+esp_err_t nvs_read_int8(const char *namespace_name, const char *key, void *out_value);
+esp_err_t nvs_read_uint8(const char *namespace_name, const char *key, void *out_value);
+esp_err_t nvs_read_int16(const char *namespace_name, const char *key, void *out_value);
+esp_err_t nvs_read_uint16(const char *namespace_name, const char *key, void *out_value);
+esp_err_t nvs_read_int32(const char *namespace_name, const char *key, void *out_value);
+esp_err_t nvs_read_uint32(const char *namespace_name, const char *key, void *out_value);
+esp_err_t nvs_read_int64(const char *namespace_name, const char *key, void *out_value);
+esp_err_t nvs_read_uint64(const char *namespace_name, const char *key, void *out_value);
+esp_err_t nvs_read_string(const char *namespace_name, const char *key, void *out_value);  // Please see an example below.
+esp_err_t nvs_read_float(const char *namespace_name, const char *key, void *out_value);
+esp_err_t nvs_read_double(const char *namespace_name, const char *key, void *out_value);
+esp_err_t nvs_read_blob(const char *namespace_name, const char *key, void *out_value, size_t length);
+
+/**
+ * @brief Read string for given key into a caller-provided buffer
+ *
+ * Unlike nvs_read_string(), the heap is never used and the value is looked up only once.
+ *
+ * @param[in]     namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in]     key Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[out]    buffer Buffer for the zero-terminated string. May be NULL to query the required size.
+ * @param[in,out] length Size of the buffer on input. Size of the string including the zero terminator on output.
+ * @return
+ *         - ESP_OK if the string was read (or its size, if buffer is NULL).
+ *         - ESP_ERR_NVS_INVALID_LENGTH if the buffer is too small; length holds the required size and buffer an empty string.
+ *         - ESP_ERR_NVS_NOT_FOUND if the requested key doesn’t exist.
+ *         - other error codes from the underlying storage driver.
+ */
+esp_err_t nvs_read_string_into(const char *namespace_name, const char *key, char *buffer, size_t *length);
+
+/**
+ * @brief Check whether a key exists and get its type and length without reading the value
+ *
+ * Nothing is logged and nothing is allocated, so this is the cheap way to probe optional keys. A queued write
+ * counts as existing. Blobs report their stored length; use nvs_blob_size() for the length of a compressed or
+ * chunked blob.
+ *
+ * @param[in]  namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in]  key Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[out] out_type Type of the value, or NULL.
+ * @param[out] out_length Length of the value (including the zero terminator for strings), or NULL.
+ * @return
+ *         - ESP_OK if the key exists.
+ *         - ESP_ERR_NVS_NOT_FOUND if the key or the namespace doesn’t exist.
+ *         - other error codes from the underlying storage driver.
+ */
+esp_err_t nvs_key_exists(const char *namespace_name, const char *key, nvs_type_t *out_type, size_t *out_length);
+
+/**
+ * @brief Key bound by nvs_key_bind(): namespace and key checked once, the namespace handle resolved once
+ *
+ * Reads and writes through it skip the argument checks, the handle lookup and hashing the namespace to its lock.
+ * The handle is resolved again only if the handle cache closed a handle in the meantime, or on the first write:
+ * until then it is read-only. Queued writes, the value cache and nvs_set_skip_unchanged() are honoured as by
+ * nvs_read_*()/nvs_write_*(). The fields are private, use the functions below. A bound key needs no release.
+ */
+typedef struct {
+    char namespace_name[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_type_t type;
+    nvs_handle_t handle;
+    nvs_open_mode_t open_mode;  // NVS_READONLY until the first write
+    uint32_t generation;        // Handle cache generation the handle belongs to
+    uint32_t shard;             // Namespace lock the namespace is hashed to
+} nvs_key_ref_t;
+
+/**
+ * @brief Check a key once and resolve its namespace handle, for keys read or written very often
+ *
+ * float and double values are bound as NVS_TYPE_U32/NVS_TYPE_U64 (the format of nvs_write_float()/nvs_write_double()).
+ * The namespace is opened read-only, so binding doesn't create it; a namespace which doesn't exist yet is no error,
+ * reads report ESP_ERR_NVS_NOT_FOUND until the first nvs_key_write() creates it.
+ *
+ * @param[in]  namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in]  key Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in]  type_value Type of the value: NVS_TYPE_I8...NVS_TYPE_U64, NVS_TYPE_STR or NVS_TYPE_BLOB.
+ * @param[out] out_ref Bound key.
+ * @return
+ *         - ESP_OK if the key was bound.
+ *         - ESP_ERR_NVS_KEY_TOO_LONG if namespace or key name is too long.
+ *         - ESP_ERR_INVALID_ARG if type_value is NVS_TYPE_ANY.
+ *         - Error codes of nvs_open() if the namespace exists but can't be opened.
+ */
+esp_err_t nvs_key_bind(const char *namespace_name, const char *key, nvs_type_t type_value, nvs_key_ref_t *out_ref);
+
+/**
+ * @brief Read the value of a bound key
+ *
+ * @param[in]     ref Key bound by nvs_key_bind().
+ * @param[out]    out_value Pointer to the value of the bound type. For strings with length NULL, pointer to a char*
+ *                          which receives a heap copy (see nvs_read_string()).
+ * @param[in,out] length Size of the string or blob buffer on input, length of the value on output; NULL for
+ *                       integers.
+ * @return
+ *         - Error codes of nvs_read_*().
+ */
+esp_err_t nvs_key_read(nvs_key_ref_t *ref, void *out_value, size_t *length);
+
+/**
+ * @brief Write the value of a bound key
+ *
+ * @param[in] ref Key bound by nvs_key_bind().
+ * @param[in] value Pointer to the value of the bound type, or to the zero-terminated string.
+ * @param[in] length Length of the blob, ignored for other types.
+ * @return
+ *         - Error codes of nvs_write_*().
+ */
+esp_err_t nvs_key_write(nvs_key_ref_t *ref, const void *value, size_t length);
+
+/**
+ * @brief Convert a float or double stored by an older version of this library to the binary format
+ *
+ * float and double are stored as their raw bit patterns in a u32/u64 entry. Older versions stored them as "%f"
+ * strings; nvs_read_float()/nvs_read_double() still read such values, and these functions rewrite them once in the
+ * binary format, for example at the first boot after a firmware update.
+ *
+ * @param[in] namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in] key Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @return
+ *         - ESP_OK if the value was migrated or is already stored in the binary format.
+ *         - ESP_ERR_NVS_NOT_FOUND if the requested key doesn’t exist.
+ *         - ESP_ERR_NVS_TYPE_MISMATCH if the key holds a string which is not a number.
+ *         - other error codes from the underlying storage driver.
+ */
+esp_err_t nvs_migrate_float(const char *namespace_name, const char *key);
+esp_err_t nvs_migrate_double(const char *namespace_name, const char *key);
 
 // IMPORTANT NOTE!: This applies ONLY to strings. Remember to delete the pointer to avoid a memory leak.
+// Use nvs_read_string_into() to read a string into your own buffer without any allocation.
 /* For example:
 
     char *read_string = NULL;
@@ -115,8 +329,1116 @@ esp_err_t nvs_read_blob(const char *namespace, const char *key, void *out_value,
 
 */
 
+/**
+ * @brief Called by nvs_load_namespace() for every value of the namespace
+ *
+ * value points to the integer, the zero-terminated string or the blob and is valid only during the call. length is
+ * the size of the value, including the zero terminator of strings. float and double values are delivered as
+ * NVS_TYPE_U32/NVS_TYPE_U64 holding their bit pattern. Return ESP_OK to continue, anything else stops the load and
+ * is returned by nvs_load_namespace().
+ */
+typedef esp_err_t (*nvs_load_callback_t)(const char *key, nvs_type_t type, const void *value, size_t length,
+                                         void *ctx);
+
+/**
+ * @brief Read all values of a namespace in one pass
+ *
+ * Walks the namespace once with the NVS entry iterator and reads every entry through a single handle, instead of
+ * one nvs_read_*() call per key. Values of namespaces with the value cache enabled are cached on the way.
+ * Values still in the write queue (see nvs_async_start()) are not seen, call nvs_flush() first.
+ *
+ * @param[in] namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in] callback Called for every value, in storage order.
+ * @param[in] ctx Passed to the callback.
+ * @return
+ *         - ESP_OK if all values were delivered (also if the namespace is empty or doesn't exist).
+ *         - ESP_ERR_INVALID_ARG if namespace or callback is NULL.
+ *         - The error returned by the callback, if it stopped the load.
+ *         - other error codes from the underlying storage driver.
+ */
+esp_err_t nvs_load_namespace(const char *namespace_name, nvs_load_callback_t callback, void *ctx);
+
+/**
+ * @brief RAM copy of all values of a namespace, loaded by nvs_snapshot_load()
+ *
+ * The fields are private, use the functions below.
+ */
+typedef struct {
+    struct nvs_txn_op_s *entries;  // Sorted by key
+    size_t count;
+    size_t capacity;
+} nvs_snapshot_t;
+
+/**
+ * @brief Load all values of a namespace into a RAM table with nvs_load_namespace()
+ *
+ * @param[in]  namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[out] snapshot Snapshot to fill, release it with nvs_snapshot_free().
+ * @return
+ *         - ESP_OK if the snapshot was loaded.
+ *         - ESP_ERR_NO_MEM if the values could not be copied.
+ *         - Error codes of nvs_load_namespace() otherwise; the snapshot is empty then.
+ */
+esp_err_t nvs_snapshot_load(const char *namespace_name, nvs_snapshot_t *snapshot);
+
+/**
+ * @brief Get a value from a snapshot, without touching flash
+ *
+ * @param[in]     snapshot Snapshot loaded by nvs_snapshot_load().
+ * @param[in]     key Key name.
+ * @param[in]     type Type of the value; NVS_TYPE_U32/NVS_TYPE_U64 for float/double.
+ * @param[out]    value Integer to fill, or buffer for strings and blobs (NULL to query the size).
+ * @param[in,out] length Strings and blobs only: size of the buffer on input, size of the value on output.
+ * @return
+ *         - ESP_OK if the value was found.
+ *         - ESP_ERR_NVS_NOT_FOUND if the snapshot has no value of this type under the key.
+ *         - ESP_ERR_NVS_INVALID_LENGTH if the buffer is too small; length holds the required size.
+ */
+esp_err_t nvs_snapshot_get(const nvs_snapshot_t *snapshot, const char *key, nvs_type_t type,
+                           void *value, size_t *length);
+
+/**
+ * @brief Release the memory of a snapshot
+ *
+ * @param[in] snapshot Snapshot loaded by nvs_snapshot_load().
+ */
+void nvs_snapshot_free(nvs_snapshot_t *snapshot);
+
+/**
+ * @brief Counters of the value cache
+ */
+typedef struct {
+    uint32_t hits;    // Reads served from RAM
+    uint32_t misses;  // Reads of cache-enabled namespaces which had to go to flash
+    size_t used;      // Bytes used by the cached values
+    size_t budget;    // Maximum number of bytes, 0 if the cache is disabled
+} nvs_value_cache_stats_t;
+
+/**
+ * @brief Configure the memory budget of the value cache
+ *
+ * The value cache keeps recently read and written values of selected namespaces in RAM, so repeated reads of the
+ * same key do not touch flash. Writes through this library update the cached value. When the budget is exceeded,
+ * the least recently used values are dropped. The cache is disabled by default (budget 0).
+ *
+ * @param[in] budget Maximum number of bytes for the cached values and their bookkeeping, 0 to disable the cache.
+ * @return
+ *         - ESP_OK on success.
+ */
+esp_err_t nvs_value_cache_configure(size_t budget);
+
+/**
+ * @brief Enable or disable the value cache for one namespace (see NVS_VALUE_CACHE_MAX_NAMESPACES)
+ *
+ * @param[in] namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in] enable true to cache the values of the namespace, false to stop caching and drop its values.
+ * @return
+ *         - ESP_OK on success.
+ *         - ESP_ERR_INVALID_ARG if the namespace name is NULL or too long.
+ *         - ESP_ERR_NO_MEM if the cache is already enabled for NVS_VALUE_CACHE_MAX_NAMESPACES namespaces.
+ */
+esp_err_t nvs_value_cache_enable(const char *namespace_name, bool enable);
+
+/**
+ * @brief Drop cached values, so the next read goes to flash
+ *
+ * Needed only if the partition is changed bypassing this library.
+ *
+ * @param[in] namespace_name Namespace name, or NULL for all namespaces.
+ * @param[in] key Key name, or NULL for all keys of the namespace.
+ */
+void nvs_value_cache_invalidate(const char *namespace_name, const char *key);
+
+/**
+ * @brief Get the counters of the value cache
+ *
+ * @param[out] stats Counters.
+ */
+void nvs_value_cache_get_stats(nvs_value_cache_stats_t *stats);
+
+#define NVS_METRICS_HISTOGRAM_BUCKETS 8  // Upper limits 10 us, 100 us, 1 ms, 5 ms, 10 ms, 50 ms, 100 ms, unlimited
+#define NVS_METRICS_ERROR_SLOTS 8        // Number of different error codes counted separately
+
+/**
+ * @brief Latency distribution of one kind of operation
+ */
+typedef struct {
+    uint32_t count;
+    uint32_t buckets[NVS_METRICS_HISTOGRAM_BUCKETS];  // Number of operations per latency range
+    uint64_t total_us;
+    uint32_t max_us;
+} nvs_latency_histogram_t;
+
+/**
+ * @brief Number of failures with one error code
+ */
+typedef struct {
+    esp_err_t code;  // ESP_OK if the slot is unused
+    uint32_t count;
+} nvs_error_count_t;
+
+/**
+ * @brief Operation counters and latency histograms, see nvs_get_metrics()
+ */
+typedef struct {
+    uint32_t opens;          // nvs_open() calls, namespace handles not found in the handle cache
+    uint32_t commits;        // nvs_commit() calls
+    uint32_t writes;         // Values written to flash
+    uint64_t bytes_written;  // Size of the values written to flash
+    uint32_t reads;          // Values read from flash or the value cache
+    uint32_t not_found;      // Reads of keys which don't exist
+    uint32_t failures;       // Failed operations, by error code in errors[]
+    nvs_error_count_t errors[NVS_METRICS_ERROR_SLOTS];
+    uint32_t other_errors;   // Failures whose error code didn't fit into errors[]
+    nvs_latency_histogram_t open_latency;
+    nvs_latency_histogram_t read_latency;
+    nvs_latency_histogram_t write_latency;  // Write and commit of one value, or of a whole transaction
+} nvs_metrics_t;
+
+/**
+ * @brief Get the operation counters and latency histograms
+ *
+ * Metrics are compiled in only with -DNVS_ENABLE_METRICS=1, they cost nothing otherwise.
+ *
+ * @param[out] metrics Counters since nvs_init() or the last nvs_reset_metrics().
+ * @return
+ *         - ESP_OK on success.
+ *         - ESP_ERR_INVALID_ARG if metrics is NULL.
+ *         - ESP_ERR_NOT_SUPPORTED if the library is built without metrics.
+ */
+esp_err_t nvs_get_metrics(nvs_metrics_t *metrics);
+
+/**
+ * @brief Set all metrics to zero
+ */
+void nvs_reset_metrics(void);
+
+/**
+ * @brief Set when counters changed by nvs_counter_add() are written to flash
+ *
+ * A counter is written by the nvs_counter_add() call which finds it due: when its unwritten increments reach
+ * threshold, or when interval_ms passed since it was last written. By default only the interval applies, 60 s.
+ *
+ * @param[in] interval_ms Minimum time between two writes of a counter, 0 to write on threshold only.
+ * @param[in] threshold Sum of unwritten increments which triggers a write, 0 to write on interval only.
+ * @return
+ *         - ESP_OK on success.
+ */
+esp_err_t nvs_counter_configure(uint32_t interval_ms, uint64_t threshold);
+
+/**
+ * @brief Add to a persistent counter, in RAM until the counter is due (see nvs_counter_configure())
+ *
+ * The counter is stored in NVS_COUNTER_SLOTS keys "<key>#0", "<key>#1"... which are written in turn, and recovered
+ * from the largest of them. Increments not written yet are lost on a reset, call nvs_counter_flush() before a
+ * planned one. Up to NVS_COUNTER_MAX_COUNT counters are kept in RAM.
+ *
+ * @param[in] namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in] key Counter name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-3) characters. Shouldn’t be empty.
+ * @param[in] delta Value to add.
+ * @return
+ *         - ESP_OK if the value was added (and written, if the counter was due).
+ *         - ESP_ERR_NVS_KEY_TOO_LONG if namespace or key name is too long.
+ *         - ESP_ERR_NO_MEM if NVS_COUNTER_MAX_COUNT counters are already in use.
+ *         - Error codes of nvs_write_*() if the counter was due and could not be written; it is tried again later.
+ */
+esp_err_t nvs_counter_add(const char *namespace_name, const char *key, uint64_t delta);
+
+/**
+ * @brief Get the current value of a persistent counter from RAM, including increments not written yet
+ *
+ * @param[in]  namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in]  key Counter name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-3) characters. Shouldn’t be empty.
+ * @param[out] out_value Value of the counter, 0 if it was never written.
+ * @return
+ *         - ESP_OK on success.
+ *         - Error codes of nvs_counter_add() otherwise.
+ */
+esp_err_t nvs_counter_get(const char *namespace_name, const char *key, uint64_t *out_value);
+
+/**
+ * @brief Write every counter with increments not written yet. Called by nvs_deinit() as well.
+ *
+ * @return
+ *         - ESP_OK if all counters are written.
+ *         - The first error otherwise.
+ */
+esp_err_t nvs_counter_flush(void);
+
+/**
+ * @brief Transaction: a batch of values written to one namespace with a single nvs_commit()
+ *
+ * Values are buffered in RAM by nvs_txn_set_*() and written to flash by nvs_txn_commit(), which opens the namespace
+ * once and commits once. nvs_txn_abort() drops the buffered values without touching flash.
+ * The fields are private, use the functions below.
+ */
+typedef struct {
+    char namespace_name[NVS_KEY_NAME_MAX_SIZE];
+    struct nvs_txn_op_s *ops;
+    size_t count;
+    size_t capacity;
+    esp_err_t err;  // First error of the transaction, reported again by every following call
+} nvs_txn_t;
+
+/**
+ * @brief Start a transaction on the given namespace
+ *
+ * @param[in]  namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[out] txn Transaction to initialize.
+ * @return
+ *         - ESP_OK if the transaction was started.
+ *         - ESP_ERR_NVS_KEY_TOO_LONG if namespace name is too long.
+ *         - Error codes of nvs_open() if the namespace can't be opened.
+ */
+esp_err_t nvs_txn_begin(const char *namespace_name, nvs_txn_t *txn);
+
+/**
+ * @brief Add int8_t, uint8, int16... value to the transaction
+ *
+ * Nothing is written to flash until nvs_txn_commit(). Once a call fails, the transaction keeps the error and every
+ * following call (including nvs_txn_commit()) returns it.
+ *
+ * @param[in] txn Transaction started with nvs_txn_begin().
+ * @param[in] key Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in] value The value to set.
+ * @return
+ *         - ESP_OK if value was added to the transaction.
+ *         - ESP_ERR_NO_MEM if the value could not be buffered.
+ *         - ESP_ERR_NVS_KEY_TOO_LONG if key name is too long.
+ *         - ESP_ERR_INVALID_STATE if the transaction was already committed or aborted.
+ */
+esp_err_t nvs_txn_set_int8(nvs_txn_t *txn, const char *key, int8_t value);
+esp_err_t nvs_txn_set_uint8(nvs_txn_t *txn, const char *key, uint8_t value);
+esp_err_t nvs_txn_set_int16(nvs_txn_t *txn, const char *key, int16_t value);
+esp_err_t nvs_txn_set_uint16(nvs_txn_t *txn, const char *key, uint16_t value);
+esp_err_t nvs_txn_set_int32(nvs_txn_t *txn, const char *key, int32_t value);
+esp_err_t nvs_txn_set_uint32(nvs_txn_t *txn, const char *key, uint32_t value);
+esp_err_t nvs_txn_set_int64(nvs_txn_t *txn, const char *key, int64_t value);
+esp_err_t nvs_txn_set_uint64(nvs_txn_t *txn, const char *key, uint64_t value);
+esp_err_t nvs_txn_set_string(nvs_txn_t *txn, const char *key, const char *value);
+esp_err_t nvs_txn_set_float(nvs_txn_t *txn, const char *key, float value);
+esp_err_t nvs_txn_set_double(nvs_txn_t *txn, const char *key, double value);
+esp_err_t nvs_txn_set_blob(nvs_txn_t *txn, const char *key, const void *value, size_t length);
+
+/**
+ * @brief Write all values of the transaction and commit them once, or drop them
+ *
+ * The values are written in the order they were added. If one of them fails, the rest is skipped and the error is
+ * returned; the values written before it stay in flash. Both functions release the transaction.
+ *
+ * @param[in] txn Transaction started with nvs_txn_begin().
+ * @return
+ *         - ESP_OK if all values were written and committed.
+ *         - The first error of the transaction otherwise (see nvs_write_*() for the list).
+ */
+esp_err_t nvs_txn_commit(nvs_txn_t *txn);
+void nvs_txn_abort(nvs_txn_t *txn);
+
+/**
+ * @brief Description of one field of a struct stored by nvs_struct_load()/nvs_struct_save()
+ *
+ * Every field is stored under its own key, so fields can be added to or removed from the struct later; missing
+ * keys are filled with the default. Integer fields use their NVS type, float and double fields NVS_TYPE_U32 and
+ * NVS_TYPE_U64 (the format of nvs_write_float()/nvs_write_double()). String fields are char arrays, blob fields
+ * any fixed-size member.
+ */
+typedef struct {
+    const char *key;            // Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters.
+    nvs_type_t type;            // Type the value is stored as
+    size_t offset;              // offsetof() the member
+    size_t size;                // sizeof() the member
+    const void *default_value;  // Value of a missing key: pointer to the value, a string or NULL for zero
+} nvs_field_t;
+
+/**
+ * @brief Describe a struct member stored under its own name (which must fit into a key, 15 characters)
+ *
+ * For example:
+
+    typedef struct {
+        uint16_t port;
+        char host[32];
+    } config_t;
+
+    static const nvs_field_t config_fields[] = {
+        NVS_FIELD(config_t, port, NVS_TYPE_U16, &(uint16_t){ 8080 }),
+        NVS_FIELD(config_t, host, NVS_TYPE_STR, "localhost"),
+    };
+
+    config_t config;
+    nvs_struct_load("config", config_fields, sizeof(config_fields) / sizeof(config_fields[0]), &config);
+
+ */
+#define NVS_FIELD(struct_type, member, nvs_type, default_pointer)  \
+    NVS_FIELD_KEY(#member, struct_type, member, nvs_type, default_pointer)
+
+/**
+ * @brief Describe a struct member stored under the given key
+ */
+#define NVS_FIELD_KEY(key_name, struct_type, member, nvs_type, default_pointer) {  \
+        .key = (key_name),                                                          \
+        .type = (nvs_type),                                                         \
+        .offset = offsetof(struct_type, member),                                    \
+        .size = sizeof(((struct_type*)0)->member),                                  \
+        .default_value = (default_pointer),                                         \
+    }
+
+/**
+ * @brief Read all fields of a struct from one namespace, filling missing keys with their default
+ *
+ * If the namespace doesn't exist yet, the whole struct is set to the defaults without touching the keys.
+ *
+ * @param[in]  namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in]  fields Descriptions of the fields.
+ * @param[in]  field_count Number of fields.
+ * @param[out] record Struct to fill.
+ * @return
+ *         - ESP_OK if every field was read or set to its default.
+ *         - ESP_ERR_INVALID_ARG if a field has no key, a too long key or a size which doesn't match its type.
+ *         - ESP_ERR_NVS_INVALID_LENGTH if a stored string doesn't fit into its field.
+ *         - other error codes from the underlying storage driver; fields after the failed one are not read.
+ */
+esp_err_t nvs_struct_load(const char *namespace_name, const nvs_field_t *fields, size_t field_count, void *record);
+
+/**
+ * @brief Write all fields of a struct to one namespace with a single commit
+ *
+ * The fields are written like a transaction (see nvs_txn_commit()).
+ *
+ * @param[in] namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in] fields Descriptions of the fields.
+ * @param[in] field_count Number of fields.
+ * @param[in] record Struct to write.
+ * @return
+ *         - ESP_OK if all fields were written and committed.
+ *         - ESP_ERR_INVALID_ARG if a field has no key, a too long key or a size which doesn't match its type.
+ *         - ESP_ERR_INVALID_SIZE if a string field is not zero-terminated.
+ *         - Error codes of nvs_txn_commit() otherwise.
+ */
+esp_err_t nvs_struct_save(const char *namespace_name, const nvs_field_t *fields, size_t field_count, const void *record);
+
+/**
+ * @brief One value read by nvs_read_multi()
+ *
+ * Integer values use their NVS type, float and double values NVS_TYPE_U32 and NVS_TYPE_U64 (the format of
+ * nvs_write_float()/nvs_write_double()). Strings and blobs are read into the buffer value of length bytes.
+ */
+typedef struct {
+    const char *namespace_name;  // Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters.
+    const char *key;             // Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters.
+    nvs_type_t type;             // Type of the value: NVS_TYPE_I8...NVS_TYPE_U64, NVS_TYPE_STR or NVS_TYPE_BLOB
+    void *value;                 // Where the value is read to
+    size_t length;               // Strings and blobs: size of the buffer on input, length of the value on output
+    esp_err_t result;            // Set by nvs_read_multi(): result of this value, as of nvs_read_*()
+} nvs_req_t;
+
+/**
+ * @brief Read a batch of values from one or more namespaces
+ *
+ * The requests are grouped by namespace, so every namespace is opened once and the lock is taken once for the
+ * whole batch. Every request gets its own result; a missing key (ESP_ERR_NVS_NOT_FOUND) leaves its value untouched
+ * and doesn't stop the other requests, nor does any other failed request.
+ *
+ * @param[in,out] reqs Requests, their results and values are set.
+ * @param[in]     count Number of requests.
+ * @return
+ *         - ESP_OK if every request was read or its key doesn't exist.
+ *         - The error of the first request which failed otherwise; see the result of each request.
+ */
+esp_err_t nvs_read_multi(nvs_req_t *reqs, size_t count);
+
+/**
+ * @brief Flags of nvs_read_*_or_default()
+ */
+typedef enum {
+    NVS_DEFAULT_NONE = 0,          // Only return the default of a missing key
+    NVS_DEFAULT_PERSIST = 1 << 0,  // Also write the default of a missing key back, batched by nvs_defaults_flush()
+} nvs_default_flags_t;
+
+/**
+ * @brief Read a value, or get the default if the key doesn't exist
+ *
+ * A missing key or namespace is not logged, other errors are logged and give the default as well. With
+ * NVS_DEFAULT_PERSIST the default of a missing key is kept in RAM and written by the next nvs_defaults_flush() or
+ * nvs_deinit(), all defaults of a namespace with a single commit. Until then nvs_read_*() still reports the key as
+ * missing. Floats and doubles are read as nvs_read_float()/nvs_read_double() do.
+ *
+ * @param[in] namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in] key Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in] default_value Value returned if the key can't be read.
+ * @param[in] flags NVS_DEFAULT_NONE or NVS_DEFAULT_PERSIST.
+ * @return The stored value or default_value.
+ */
+int8_t nvs_read_int8_or_default(const char *namespace_name, const char *key, int8_t default_value, uint32_t flags);
+uint8_t nvs_read_uint8_or_default(const char *namespace_name, const char *key, uint8_t default_value, uint32_t flags);
+int16_t nvs_read_int16_or_default(const char *namespace_name, const char *key, int16_t default_value, uint32_t flags);
+uint16_t nvs_read_uint16_or_default(const char *namespace_name, const char *key, uint16_t default_value, uint32_t flags);
+int32_t nvs_read_int32_or_default(const char *namespace_name, const char *key, int32_t default_value, uint32_t flags);
+uint32_t nvs_read_uint32_or_default(const char *namespace_name, const char *key, uint32_t default_value, uint32_t flags);
+int64_t nvs_read_int64_or_default(const char *namespace_name, const char *key, int64_t default_value, uint32_t flags);
+uint64_t nvs_read_uint64_or_default(const char *namespace_name, const char *key, uint64_t default_value, uint32_t flags);
+float nvs_read_float_or_default(const char *namespace_name, const char *key, float default_value, uint32_t flags);
+double nvs_read_double_or_default(const char *namespace_name, const char *key, double default_value, uint32_t flags);
+
+/**
+ * @brief Read a string into a buffer, or copy the default there if the key doesn't exist
+ *
+ * The same as the functions above, for strings.
+ *
+ * @param[in]  namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in]  key Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in]  default_value Zero-terminated string used if the key doesn't exist.
+ * @param[out] buffer Buffer receiving the stored string or the default.
+ * @param[in]  length Size of the buffer.
+ * @param[in]  flags NVS_DEFAULT_NONE or NVS_DEFAULT_PERSIST.
+ * @return
+ *         - ESP_OK if the stored string or (for a missing key) the default was copied.
+ *         - ESP_ERR_NVS_INVALID_LENGTH if the default doesn't fit into the buffer.
+ *         - The error of the read otherwise; the buffer holds the default.
+ */
+esp_err_t nvs_read_string_or_default(const char *namespace_name, const char *key, const char *default_value,
+                                     char *buffer, size_t length, uint32_t flags);
+
+/**
+ * @brief Write the defaults kept by nvs_read_*_or_default() with NVS_DEFAULT_PERSIST, one commit per namespace
+ *
+ * Keys written in the meantime keep their value. Called by nvs_deinit() as well.
+ *
+ * @return
+ *         - ESP_OK if all pending defaults were written.
+ *         - The first error otherwise.
+ */
+esp_err_t nvs_defaults_flush(void);
+
+/**
+ * @brief Record log: a ring of blob segments records are appended to
+ *
+ * Every segment is a blob "<name>.<index>" holding a header with its sequence number and the records, each with
+ * its length in front. An append writes only the segment it goes to; a full segment continues in the next one,
+ * which replaces the oldest segment once all segment_count are used. Records are numbered from 0; the number of
+ * the oldest record kept (set by nvs_log_trim()) is stored under the key "<name>". When the log is opened, the
+ * segment with the largest sequence number is the head, so a power loss loses at most the append in progress.
+ * The fields are private, use the functions below. A log must not be used by two tasks at the same time.
+ */
+typedef struct {
+    char namespace_name[NVS_KEY_NAME_MAX_SIZE];
+    char name[NVS_KEY_NAME_MAX_SIZE - 3];  // Room for the segment index
+    size_t segment_size;
+    uint32_t segment_count;
+    uint32_t head_segment;  // Sequence number of the segment appended to
+    uint32_t first_record;  // Sequence number of the oldest record not trimmed
+    uint32_t next_record;   // Sequence number of the next record appended
+    uint8_t *buffer;        // RAM copy of the head segment
+    size_t used;            // Bytes of the head segment
+} nvs_log_t;
+
+/**
+ * @brief Called by nvs_log_iterate() for every record, oldest first
+ *
+ * record is valid only during the call. Return ESP_OK to continue, anything else stops the iteration and is
+ * returned by nvs_log_iterate().
+ */
+typedef esp_err_t (*nvs_log_callback_t)(uint32_t sequence, const void *record, size_t length, void *ctx);
+
+/**
+ * @brief Open a record log, creating it if it doesn't exist
+ *
+ * @param[in]  namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in]  name Log name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-4) characters. Shouldn’t be empty.
+ * @param[in]  segment_size Maximum size of a segment in bytes, 8 bytes of it are the header. Smaller segments make
+ *                          appends cheaper, the largest record must fit into one segment (2 bytes more than its
+ *                          length).
+ * @param[in]  segment_count Number of segments, 2...100. The log keeps about segment_count-1 full segments.
+ * @param[out] log Log to initialize, release it with nvs_log_close().
+ * @return
+ *         - ESP_OK if the log was opened.
+ *         - ESP_ERR_NVS_KEY_TOO_LONG if namespace or log name is too long.
+ *         - ESP_ERR_INVALID_ARG if segment size or count is out of range.
+ *         - ESP_ERR_INVALID_STATE if the log exists with another segment size or count.
+ *         - ESP_ERR_NO_MEM if the segment buffer can't be allocated.
+ *         - other error codes from the underlying storage driver.
+ */
+esp_err_t nvs_log_open(const char *namespace_name, const char *name, size_t segment_size, uint32_t segment_count,
+                       nvs_log_t *log);
+
+/**
+ * @brief Append a record to the log, writing only the head segment
+ *
+ * @param[in] log Log opened by nvs_log_open().
+ * @param[in] record Record to append.
+ * @param[in] length Length of the record in bytes, records may have different lengths.
+ * @return
+ *         - ESP_OK if the record was written (or queued, see nvs_async_start()).
+ *         - ESP_ERR_INVALID_SIZE if the record doesn't fit into a segment.
+ *         - Error codes of nvs_write_blob() otherwise; the log is unchanged.
+ */
+esp_err_t nvs_log_append(nvs_log_t *log, const void *record, size_t length);
+
+/**
+ * @brief Call callback for every record of the log which is not trimmed, oldest first
+ *
+ * @param[in] log Log opened by nvs_log_open().
+ * @param[in] callback Function called for every record.
+ * @param[in] ctx Passed to callback.
+ * @return
+ *         - ESP_OK if every record was delivered.
+ *         - ESP_ERR_INVALID_SIZE if a stored segment is corrupted.
+ *         - The value returned by callback if it stopped the iteration.
+ *         - other error codes from the underlying storage driver.
+ */
+esp_err_t nvs_log_iterate(const nvs_log_t *log, nvs_log_callback_t callback, void *ctx);
+
+/**
+ * @brief Drop the records older than sequence and erase the segments holding only such records
+ *
+ * @param[in] log Log opened by nvs_log_open().
+ * @param[in] sequence Sequence number of the oldest record to keep; larger than the last record drops all.
+ * @return
+ *         - ESP_OK on success.
+ *         - other error codes from the underlying storage driver.
+ */
+esp_err_t nvs_log_trim(nvs_log_t *log, uint32_t sequence);
+
+/**
+ * @brief Release the RAM of the log, the records stay in flash
+ */
+void nvs_log_close(nvs_log_t *log);
+
+/**
+ * @brief Chunked blob: a blob of up to 256 shards split into shard blobs under a manifest
+ *
+ * The manifest blob "<key>" records the length, the shard size (NVS_CHUNKED_SHARD_SIZE when the blob is first
+ * written) and which of its two keys every shard is stored under; the data is stored in the blobs "<key>.000",
+ * "<key>.001"... or "<key>:000", "<key>:001"... New shards are written under the key the stored copy doesn't use,
+ * the manifest then switches to them and the old copies are erased. A write interrupted by a power loss leaves the
+ * old or the new version, never a mix, and needs room for both copies of the shards it writes. A writer rewrites
+ * every shard; nvs_chunked_update() only the shards the range falls into. Chunked blobs are read with
+ * nvs_chunked_read() or a blob reader, not with nvs_read_blob().
+ */
+
+/**
+ * @brief Streaming writer of a chunked blob, only one shard is buffered in RAM
+ *
+ * The fields are private, use the functions below.
+ */
+typedef struct {
+    char namespace_name[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE - 4];  // Room for the shard index
+    size_t shard_size;
+    size_t length;           // Bytes written so far
+    uint32_t stored_shards;  // Shards of the stored version, erased if the new one is shorter
+    uint8_t *buffer;         // Shard being filled, followed by the generation bits of the stored version
+    size_t used;             // Bytes in buffer
+    esp_err_t err;           // First error of the writer, reported again by every following call
+} nvs_chunked_writer_t;
+
+/**
+ * @brief Start writing a chunked blob, replacing the stored value once nvs_chunked_writer_finish() is called
+ *
+ * If the key holds a chunked blob, its shard size is kept; any other blob under the key is replaced.
+ *
+ * @param[in]  namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in]  key Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-5) characters. Shouldn’t be empty.
+ * @param[out] writer Writer to initialize.
+ * @return
+ *         - ESP_OK if the writer was started.
+ *         - ESP_ERR_NVS_KEY_TOO_LONG if namespace or key name is too long.
+ *         - ESP_ERR_NO_MEM if the shard buffer can't be allocated.
+ */
+esp_err_t nvs_chunked_writer_begin(const char *namespace_name, const char *key, nvs_chunked_writer_t *writer);
+
+/**
+ * @brief Append data to the blob; every filled shard is written and its buffer reused
+ *
+ * Once a call fails, the writer keeps the error and every following call returns it.
+ *
+ * @param[in] writer Writer started with nvs_chunked_writer_begin().
+ * @param[in] data Data to append.
+ * @param[in] length Length of the data in bytes.
+ * @return
+ *         - ESP_OK if the data was buffered or written.
+ *         - ESP_ERR_INVALID_SIZE if the blob would need more than 256 shards (256 KiB with the default shard size).
+ *         - Error codes of nvs_write_blob() otherwise.
+ */
+esp_err_t nvs_chunked_writer_write(nvs_chunked_writer_t *writer, const void *data, size_t length);
+
+/**
+ * @brief Write the last shard and the manifest, erase the shards of the stored version, release the writer
+ *
+ * nvs_chunked_writer_abort() releases the writer without writing the manifest and erases the shards written so far;
+ * the stored version stays. A failed finish does the same.
+ *
+ * @param[in] writer Writer started with nvs_chunked_writer_begin().
+ * @return
+ *         - ESP_OK if the blob was written.
+ *         - The first error of the writer otherwise.
+ */
+esp_err_t nvs_chunked_writer_finish(nvs_chunked_writer_t *writer);
+void nvs_chunked_writer_abort(nvs_chunked_writer_t *writer);
+
+/**
+ * @brief Write a whole chunked blob from RAM, the same as a writer fed with one call
+ */
+esp_err_t nvs_chunked_write(const char *namespace_name, const char *key, const void *data, size_t length);
+
+/**
+ * @brief Overwrite or append a range of a chunked blob, reading and writing only the shards it touches
+ *
+ * @param[in] namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in] key Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-5) characters. Shouldn’t be empty.
+ * @param[in] offset Offset of the range, at most the length of the blob (which appends).
+ * @param[in] data New content of the range.
+ * @param[in] length Length of the range in bytes.
+ * @return
+ *         - ESP_OK if the range was written.
+ *         - ESP_ERR_NVS_NOT_FOUND if the blob doesn't exist.
+ *         - ESP_ERR_INVALID_ARG if offset is beyond the end of the blob.
+ *         - ESP_ERR_INVALID_SIZE if the blob would need more than 256 shards (256 KiB with the default shard size).
+ *         - ESP_ERR_NO_MEM if the shard buffer can't be allocated.
+ *         - Error codes of nvs_write_blob() otherwise.
+ */
+esp_err_t nvs_chunked_update(const char *namespace_name, const char *key, size_t offset, const void *data, size_t length);
+
+/**
+ * @brief Read a range of a chunked blob; reading it piece by piece never needs more RAM than one shard
+ *
+ * @param[in]  namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in]  key Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-5) characters. Shouldn’t be empty.
+ * @param[in]  offset Offset of the range.
+ * @param[out] out_value Buffer of at least length bytes.
+ * @param[in]  length Length of the range in bytes.
+ * @return
+ *         - ESP_OK if the range was read.
+ *         - ESP_ERR_NVS_NOT_FOUND if the blob doesn't exist.
+ *         - ESP_ERR_NVS_INVALID_LENGTH if the range is beyond the end of the blob or a shard is damaged.
+ *         - ESP_ERR_NVS_TYPE_MISMATCH if key holds something else than a chunked blob.
+ *         - other error codes from the underlying storage driver.
+ */
+esp_err_t nvs_chunked_read(const char *namespace_name, const char *key, size_t offset, void *out_value, size_t length);
+
+/**
+ * @brief Get the length of a chunked blob from its manifest
+ */
+esp_err_t nvs_chunked_size(const char *namespace_name, const char *key, size_t *out_length);
+
+/**
+ * @brief Erase a chunked blob: the manifest first, then its shards
+ */
+esp_err_t nvs_chunked_erase(const char *namespace_name, const char *key);
+
+/**
+ * @brief Get the length of any blob: the buffer nvs_read_blob() needs, or the length of a chunked blob
+ *
+ * For a blob written by nvs_write_blob_compressed() the original length is returned; finding it reads the stored
+ * blob into a heap buffer of its stored length, without decompressing it.
+ *
+ * @param[in]  namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in]  key Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[out] out_length Length of the blob in bytes.
+ * @return
+ *         - ESP_OK if the length was read.
+ *         - ESP_ERR_NVS_NOT_FOUND if the blob doesn’t exist.
+ *         - ESP_ERR_NO_MEM if the buffer can't be allocated.
+ *         - other error codes from the underlying storage driver.
+ */
+esp_err_t nvs_blob_size(const char *namespace_name, const char *key, size_t *out_length);
+
+/**
+ * @brief Cursor reading a blob in chunks of the caller's size
+ *
+ * A chunked blob (written by a blob writer or nvs_chunked_*()) is read one shard at a time, so only one shard is
+ * held in RAM. NVS can't read part of a plain blob (nvs_write_blob(), nvs_write_blob_compressed()), so such a blob is
+ * read into the heap once when the reader is opened. The fields are private, use the functions below.
+ */
+typedef struct {
+    char namespace_name[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    size_t length;      // Length of the blob
+    size_t position;    // Offset of the next byte read
+    size_t shard_size;  // 0 for a plain blob
+    uint32_t shard;     // Shard held in buffer, UINT32_MAX if none
+    uint8_t *buffer;    // One shard of a chunked blob or the whole plain blob
+} nvs_blob_reader_t;
+
+/**
+ * @brief Open a blob for reading from its start
+ *
+ * @param[in]  namespace_name Namespace name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[in]  key Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn’t be empty.
+ * @param[out] reader Reader to initialize, release it with nvs_blob_reader_close(). Its length field is the length
+ *                    of the blob.
+ * @return
+ *         - ESP_OK if the reader was opened.
+ *         - ESP_ERR_NVS_NOT_FOUND if the blob doesn’t exist.
+ *         - ESP_ERR_NO_MEM if the buffer can't be allocated.
+ *         - other error codes from the underlying storage driver.
+ */
+esp_err_t nvs_blob_reader_open(const char *namespace_name, const char *key, nvs_blob_reader_t *reader);
+
+/**
+ * @brief Read the next chunk of the blob
+ *
+ * @param[in]  reader Reader opened by nvs_blob_reader_open().
+ * @param[out] buffer Buffer for the chunk.
+ * @param[in]  size Size of the buffer in bytes.
+ * @param[out] out_read Number of bytes read, less than size only at the end of the blob and 0 after it.
+ * @return
+ *         - ESP_OK on success.
+ *         - ESP_ERR_NVS_INVALID_LENGTH if a shard is damaged.
+ *         - other error codes from the underlying storage driver.
+ */
+esp_err_t nvs_blob_reader_read(nvs_blob_reader_t *reader, void *buffer, size_t size, size_t *out_read);
+void nvs_blob_reader_close(nvs_blob_reader_t *reader);
+
+/**
+ * @brief Writer storing a blob in chunks of the caller's size, as a chunked blob
+ *
+ * The same as nvs_chunked_writer_*(): only one shard is buffered in RAM, and nvs_blob_writer_close() writes the
+ * rest and releases the writer (nvs_chunked_writer_abort() drops it). Read the blob back with a blob reader.
+ * Key names are limited to (NVS_KEY_NAME_MAX_SIZE-5) characters.
+ */
+typedef nvs_chunked_writer_t nvs_blob_writer_t;
+
+esp_err_t nvs_blob_writer_open(const char *namespace_name, const char *key, nvs_blob_writer_t *writer);
+esp_err_t nvs_blob_writer_write(nvs_blob_writer_t *writer, const void *data, size_t length);
+esp_err_t nvs_blob_writer_close(nvs_blob_writer_t *writer);
+
+/**
+ * @brief What a write does when the write queue is full
+ */
+typedef enum {
+    NVS_ASYNC_BLOCK,          // Wait up to block_timeout_ms for a free entry, then fail with ESP_ERR_TIMEOUT
+    NVS_ASYNC_REJECT,         // Fail with ESP_ERR_NO_MEM right away
+    NVS_ASYNC_WRITE_THROUGH,  // Write synchronously in the calling task, as without the queue
+} nvs_async_backpressure_t;
+
+/**
+ * @brief Called by the worker task after a queued value was written, err is the result of the write
+ */
+typedef void (*nvs_async_callback_t)(const char *namespace_name, const char *key, esp_err_t err, void *ctx);
+
+/**
+ * @brief Configuration of the write queue
+ */
+typedef struct {
+    size_t queue_length;                    // Maximum number of pending writes to different keys
+    uint32_t task_stack_size;               // Stack size of the worker task in bytes
+    unsigned task_priority;                 // Priority of the worker task
+    nvs_async_backpressure_t backpressure;  // What a write does when the queue is full
+    uint32_t block_timeout_ms;              // Maximum wait of NVS_ASYNC_BLOCK
+    nvs_async_callback_t callback;          // Optional completion callback, runs in the worker task
+    void *callback_ctx;                     // Passed to the callback
+} nvs_async_config_t;
+
+#define NVS_ASYNC_CONFIG_DEFAULT() {        \
+        .queue_length = 16,                 \
+        .task_stack_size = 4096,            \
+        .task_priority = 2,                 \
+        .backpressure = NVS_ASYNC_BLOCK,    \
+        .block_timeout_ms = 1000,           \
+        .callback = NULL,                   \
+        .callback_ctx = NULL,               \
+    }
+
+/**
+ * @brief Start the write queue: nvs_write_*() copy the value to a queue and return, a worker task writes it to flash
+ *
+ * The caller does not wait for the flash write and commit any more, which can take tens of milliseconds when NVS
+ * has to erase a page. A write to a key which is still queued replaces the queued value, so only the latest value
+ * is written and the callback is called once. Reads return queued values, so they always see the latest write.
+ * nvs_write_if_changed(), transactions and erasing stay synchronous and supersede queued writes to the same keys.
+ *
+ * Errors of queued writes are reported only to the callback; a failed write is not retried.
+ *
+ * @param[in] config Configuration, start from NVS_ASYNC_CONFIG_DEFAULT().
+ * @return
+ *         - ESP_OK if the queue was started.
+ *         - ESP_ERR_INVALID_ARG if config is NULL or queue_length is 0.
+ *         - ESP_ERR_INVALID_STATE if the queue is already running.
+ *         - ESP_ERR_NO_MEM if the queue or the task could not be created.
+ */
+esp_err_t nvs_async_start(const nvs_async_config_t *config);
+
+/**
+ * @brief Write all queued values and stop the worker task; nvs_write_*() are synchronous again
+ *
+ * Called by nvs_deinit() as well.
+ *
+ * @return
+ *         - ESP_OK if the queue was stopped.
+ *         - ESP_ERR_INVALID_STATE if the queue is not running.
+ */
+esp_err_t nvs_async_stop(void);
+
+/**
+ * @brief Wait until every queued value is written and its callback has returned
+ *
+ * Must not be called from the callback.
+ *
+ * @param[in] timeout_ms Maximum time to wait.
+ * @return
+ *         - ESP_OK if nothing is queued any more (including when the queue is not running).
+ *         - ESP_ERR_TIMEOUT if values are still queued after the timeout.
+ */
+esp_err_t nvs_flush(uint32_t timeout_ms);
+
+#define NVS_CHANGE_FLOAT  ((nvs_type_t)0xF4)  // Type reported for nvs_write_float() and nvs_txn_set_float()
+#define NVS_CHANGE_DOUBLE ((nvs_type_t)0xF8)  // Type reported for nvs_write_double() and nvs_txn_set_double()
+
+/**
+ * @brief Called after a subscribed key changed
+ *
+ * value is the new value as the caller passed it (length bytes, strings include the terminator) and is valid only
+ * during the call: a float or double with type NVS_CHANGE_FLOAT/NVS_CHANGE_DOUBLE, a compressed blob uncompressed.
+ * A chunked blob is reported with type NVS_TYPE_BLOB and its whole length; value is the data of nvs_chunked_write(),
+ * NULL after a writer or nvs_chunked_update(). An erased key or chunked blob is reported with type NVS_TYPE_ANY and
+ * value NULL, an erased namespace additionally with key NULL.
+ */
+typedef void (*nvs_change_callback_t)(const char *namespace_name, const char *key, nvs_type_t type,
+                                      const void *value, size_t length, void *ctx);
+
+/**
+ * @brief Call back on every change of a key, or of all keys starting with a prefix, instead of polling it
+ *
+ * The callback runs in the task which changed the value, once per call of nvs_write_*(), nvs_write_if_changed(),
+ * nvs_key_write(), nvs_txn_commit() (once per value), nvs_struct_save(), nvs_chunked_*(), the blob writers,
+ * nvs_erase_value() or nvs_erase_namespace() which succeeded, after the namespace was unlocked, so it may call any
+ * function of this library. With the write queue running it is called when the value is queued, which is when
+ * reads start to return it. A write skipped because the value is unchanged is not reported; neither are the keys
+ * the library keeps for itself (shards and manifests of chunked blobs, counter slots, record log segments and
+ * metadata) nor defaults written by nvs_defaults_flush(). Writes made by the callback are reported as well, beware
+ * of loops.
+ *
+ * Without subscriptions a write costs one extra comparison. Up to NVS_SUBSCRIPTIONS_MAX (8 by default)
+ * subscriptions can exist at the same time.
+ *
+ * @param[in] namespace_name Namespace to watch, NULL for all namespaces.
+ * @param[in] key_or_prefix Key to watch; a key ending in '*' (for example "wifi_*") watches every key starting with
+ *                          the part before it, NULL or "*" watches the whole namespace.
+ * @param[in] callback Called on every change.
+ * @param[in] ctx Passed to the callback.
+ * @return
+ *         - ESP_OK if the subscription was added.
+ *         - ESP_ERR_INVALID_ARG if callback is NULL, a name is too long or '*' is not the last character.
+ *         - ESP_ERR_NO_MEM if NVS_SUBSCRIPTIONS_MAX subscriptions exist.
+ */
+esp_err_t nvs_subscribe(const char *namespace_name, const char *key_or_prefix, nvs_change_callback_t callback,
+                        void *ctx);
+
+/**
+ * @brief Remove every subscription with the callback and ctx
+ *
+ * May be called from a callback. A callback already dispatched to another task may still run once.
+ *
+ * @return
+ *         - ESP_OK if at least one subscription was removed.
+ *         - ESP_ERR_NOT_FOUND if there is no such subscription.
+ */
+esp_err_t nvs_unsubscribe(nvs_change_callback_t callback, void *ctx);
+
+#define NVS_ENTRIES_PER_PAGE 126  // 32-byte entries of one 4 kB NVS page
+
+/**
+ * @brief Configuration of the idle-time maintenance
+ */
+typedef struct {
+    size_t min_free_entries;     // A pass only works while nvs_get_stats() reports fewer free entries, 0 for a quarter
+                                 // of the partition's entries (at least two pages)
+    size_t min_written_entries;  // ... and this many entries were written through this library since the last pass,
+                                 // 0 for a quarter of the partition's entries (at least four pages)
+    uint32_t interval_ms;        // Period of the maintenance task
+    uint32_t task_stack_size;    // Stack size of the maintenance task in bytes
+    unsigned task_priority;      // Priority of the maintenance task, below every task writing NVS
+} nvs_maintenance_config_t;
+
+#define NVS_MAINTENANCE_CONFIG_DEFAULT() {                     \
+        .min_free_entries = 0,                                 \
+        .min_written_entries = 0,                              \
+        .interval_ms = 1000,                                   \
+        .task_stack_size = 3072,                               \
+        .task_priority = 1,                                    \
+    }
+
+/**
+ * @brief Move the slow part of NVS writes, a page switch which may have to reclaim a page, to an idle moment
+ *
+ * A write which does not fit into the active page starts the next one; when only the reserve page is free, NVS first
+ * relocates the live entries of the page with the most erased ones and erases it, which can take tens of milliseconds
+ * inside nvs_commit(). A pass checks nvs_get_stats() and the entries written since the last pass; when the partition
+ * is that full and that much was written, it writes a filler string of one page and a one-entry marker to a private
+ * namespace and erases both. A string never spans pages, so the filler takes a page of its own and the marker starts
+ * the next: the page switches (and reclaims, if due) happen in the pass, and the following writes find an almost
+ * empty active page. The erased filler page is the cheapest one to reclaim later.
+ *
+ * Cost of a working pass: the filler and the marker are NVS_ENTRIES_PER_PAGE entries (4 kB) written and erased,
+ * plus the live entries of the reclaimed page NVS relocates if a reclaim is due, so up to two pages of flash. The
+ * default thresholds scale with the partition: a pass works only while less than a quarter of its entries are free
+ * and at least a quarter (no less than four pages) were written since the last pass, so the filler adds at most a
+ * quarter to the entries the application writes. The ESP-IDF API shows no page state, so the pass cannot tell
+ * whether a reclaim was actually due. Writes between two passes still reach page switches themselves.
+ *
+ * @param[in] config Thresholds, start from NVS_MAINTENANCE_CONFIG_DEFAULT(); the task fields are not used.
+ * @param[out] out_worked Optional, set to whether the pass wrote the filler.
+ * @return
+ *         - ESP_OK if the pass succeeded, including when there was nothing to do.
+ *         - ESP_ERR_INVALID_ARG if config is NULL.
+ *         - One of the error codes from the underlying NVS functions, for example ESP_ERR_NVS_NOT_ENOUGH_SPACE if
+ *           the filler does not fit; the thresholds should leave room for it.
+ */
+esp_err_t nvs_maintenance_run(const nvs_maintenance_config_t *config, bool *out_worked);
+
+/**
+ * @brief Start a low-priority task calling nvs_maintenance_run() every interval_ms
+ *
+ * @param[in] config Configuration, start from NVS_MAINTENANCE_CONFIG_DEFAULT().
+ * @return
+ *         - ESP_OK if the task was started.
+ *         - ESP_ERR_INVALID_ARG if config is NULL or interval_ms is 0.
+ *         - ESP_ERR_INVALID_STATE if the task is already running.
+ *         - ESP_ERR_NO_MEM if the task could not be created.
+ */
+esp_err_t nvs_maintenance_start(const nvs_maintenance_config_t *config);
+
+/**
+ * @brief Stop the maintenance task after its current pass, called by nvs_deinit() as well
+ *
+ * @return
+ *         - ESP_OK if the task was stopped.
+ *         - ESP_ERR_INVALID_STATE if the task is not running.
+ */
+esp_err_t nvs_maintenance_stop(void);
+
 #ifdef __cplusplus
 }
 #endif
 
+/*
+ * Typed generic layer, header-only.
+ *
+ * nvs_write(namespace, key, value) and nvs_read(namespace, key, &value) in C11, nvs::set(namespace, key, value) and
+ * nvs::get(namespace, key, value) in C++ pick the nvs_write_*()/nvs_read_*() function of the value's type at compile
+ * time. Types without a function (int, long, char, bool...; use the fixed-width types) and pointers of another type
+ * fail to compile instead of writing the wrong number of bytes.
+
+    uint16_t port = 8080;
+    nvs_write("config", "port", port);              // nvs_write_uint16()
+    nvs_read("config", "port", &port);              // nvs_read_uint16()
+    nvs_write("config", "host", "localhost");       // nvs_write_string()
+    char *host = NULL;
+    nvs_read("config", "host", &host);              // nvs_read_string(), free(host) afterwards
+
+    nvs::set("config", "port", port);               // C++
+    std::string name;
+    nvs::get("config", "host", name);
+
+ */
+#if defined(__cplusplus)
+
+#include <string>
+
+namespace nvs {
+
+namespace detail {
+
+// Specialized for every type with an nvs_read_*()/nvs_write_*() function, other types are incomplete
+template <typename T> struct value_traits;
+
+#define NVS_VALUE_TRAITS(value_type, suffix)                                                            \
+    template <> struct value_traits<value_type> {                                                       \
+        static esp_err_t read(const char *namespace_name, const char *key, value_type *out_value)       \
+        {                                                                                               \
+            return nvs_read_##suffix(namespace_name, key, out_value);                                   \
+        }                                                                                               \
+        static esp_err_t write(const char *namespace_name, const char *key, value_type value)           \
+        {                                                                                               \
+            return nvs_write_##suffix(namespace_name, key, value);                                      \
+        }                                                                                               \
+    }
+
+NVS_VALUE_TRAITS(int8_t, int8);
+NVS_VALUE_TRAITS(uint8_t, uint8);
+NVS_VALUE_TRAITS(int16_t, int16);
+NVS_VALUE_TRAITS(uint16_t, uint16);
+NVS_VALUE_TRAITS(int32_t, int32);
+NVS_VALUE_TRAITS(uint32_t, uint32);
+NVS_VALUE_TRAITS(int64_t, int64);
+NVS_VALUE_TRAITS(uint64_t, uint64);
+NVS_VALUE_TRAITS(float, float);
+NVS_VALUE_TRAITS(double, double);
+
+#undef NVS_VALUE_TRAITS
+
+}  // namespace detail
+
+template <typename T>
+inline esp_err_t get(const char *namespace_name, const char *key, T &out_value)
+{
+    return detail::value_traits<T>::read(namespace_name, key, &out_value);
+}
+
+template <typename T>
+inline esp_err_t set(const char *namespace_name, const char *key, const T &value)
+{
+    return detail::value_traits<T>::write(namespace_name, key, value);
+}
+
+inline esp_err_t get(const char *namespace_name, const char *key, std::string &out_value)
+{
+    size_t length = 0;
+    esp_err_t err = nvs_read_string_into(namespace_name, key, NULL, &length);
+    if (err == ESP_OK) {
+        out_value.resize(length);
+        err = nvs_read_string_into(namespace_name, key, &out_value[0], &length);
+        out_value.resize((err == ESP_OK) ? length - 1 : 0);
+    }
+    return err;
+}
+
+inline esp_err_t set(const char *namespace_name, const char *key, const char *value)
+{
+    return nvs_write_string(namespace_name, key, value);
+}
+
+inline esp_err_t set(const char *namespace_name, const char *key, const std::string &value)
+{
+    return nvs_write_string(namespace_name, key, value.c_str());
+}
+
+}  // namespace nvs
+
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+
+#define nvs_write(namespace_name, key, value)  \
+    _Generic((value),                          \
+        int8_t: nvs_write_int8,                \
+        uint8_t: nvs_write_uint8,              \
+        int16_t: nvs_write_int16,              \
+        uint16_t: nvs_write_uint16,            \
+        int32_t: nvs_write_int32,              \
+        uint32_t: nvs_write_uint32,            \
+        int64_t: nvs_write_int64,              \
+        uint64_t: nvs_write_uint64,            \
+        float: nvs_write_float,                \
+        double: nvs_write_double,              \
+        char*: nvs_write_string,               \
+        const char*: nvs_write_string          \
+    )(namespace_name, key, value)
+
+#define nvs_read(namespace_name, key, out_value)  \
+    _Generic((out_value),                         \
+        int8_t*: nvs_read_int8,                   \
+        uint8_t*: nvs_read_uint8,                 \
+        int16_t*: nvs_read_int16,                 \
+        uint16_t*: nvs_read_uint16,               \
+        int32_t*: nvs_read_int32,                 \
+        uint32_t*: nvs_read_uint32,               \
+        int64_t*: nvs_read_int64,                 \
+        uint64_t*: nvs_read_uint64,               \
+        float*: nvs_read_float,                   \
+        double*: nvs_read_double,                 \
+        char**: nvs_read_string                   \
+    )(namespace_name, key, out_value)
+
+#endif
+
 #endif  // NON_VOLATILE_STORAGE_H_
@@ -1,5 +1,8 @@
 #include "non_volatile_storage.h"
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
@@ -9,274 +12,936 @@
 
 #include "esp_check.h"
 #include "esp_err.h"
+#include "esp_idf_version.h"
 #include "esp_log.h"
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
 #include "sdkconfig.h"
 
 static const char *TAG = "non_volatile_storage";
 
-esp_err_t nvs_init(void)
+/*
+ * Compile-time log level of each part of the library, ESP_LOG_NONE...ESP_LOG_VERBOSE. Success and warning messages
+ * above the level are compiled out, errors are always logged. For example, -DNVS_LOG_LEVEL_READ=ESP_LOG_ERROR
+ * removes all logging from successful reads.
+ */
+#ifndef NVS_LOG_LEVEL_READ
+#define NVS_LOG_LEVEL_READ LOG_LOCAL_LEVEL   // nvs_read_*()
+#endif
+#ifndef NVS_LOG_LEVEL_WRITE
+#define NVS_LOG_LEVEL_WRITE LOG_LOCAL_LEVEL  // nvs_write_*()
+#endif
+#ifndef NVS_LOG_LEVEL_TXN
+#define NVS_LOG_LEVEL_TXN LOG_LOCAL_LEVEL    // nvs_txn_*()
+#endif
+#ifndef NVS_LOG_LEVEL_MAINT
+#define NVS_LOG_LEVEL_MAINT LOG_LOCAL_LEVEL  // Erase and migration
+#endif
+
+#define NVS_LOG(subsystem, level, format, ...)                         \
+    do {                                                               \
+        if (NVS_LOG_LEVEL_##subsystem >= level) {                      \
+            ESP_LOG_LEVEL_LOCAL(level, TAG, format, ##__VA_ARGS__);    \
+        }                                                              \
+    } while (0)
+
+#define NVS_LOGW(subsystem, format, ...) NVS_LOG(subsystem, ESP_LOG_WARN, format, ##__VA_ARGS__)
+#define NVS_LOGI(subsystem, format, ...) NVS_LOG(subsystem, ESP_LOG_INFO, format, ##__VA_ARGS__)
+#define NVS_LOGD(subsystem, format, ...) NVS_LOG(subsystem, ESP_LOG_DEBUG, format, ##__VA_ARGS__)
+
+#define NVS_LOG_STRING_MAX_LENGTH 32  // Longer strings are truncated in the log
+#define VALUE_STRING_SIZE 24          // Long enough for any 64-bit integer
+
+#ifndef NVS_LOCK_SHARDS
+#define NVS_LOCK_SHARDS 4  // Namespace locks; namespaces hashed to different ones are used in parallel, 1 for one lock
+#endif
+#if NVS_LOCK_SHARDS < 1
+#error "NVS_LOCK_SHARDS must be at least 1"
+#endif
+
+/*
+ * Locking, all mutexes are created by nvs_init():
+ * - A namespace lock serializes access to the namespaces hashed to it, including their handles. Operations on one
+ *   namespace take only its lock, so operations on namespaces with different locks run in parallel.
+ * - nvs_lock() takes all namespace locks in ascending order, for operations on several namespaces and for those
+ *   which call back the application. A task holding a namespace lock must not take nvs_lock() or another
+ *   namespace lock, all locks are recursive though.
+ * - The state lock protects the caches and the metrics shared by all namespaces. It is taken last and held only
+ *   for the RAM access.
+ */
+static SemaphoreHandle_t nvs_shard_mutexes[NVS_LOCK_SHARDS];
+static SemaphoreHandle_t nvs_state_mutex = NULL;
+
+// FNV-1a of the name, NULL is an invalid argument detected later
+static size_t namespace_shard(const char *namespace)
 {
-    esp_err_t err = nvs_flash_init();
-    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        err = nvs_flash_init();
+    uint32_t hash = 0x811C9DC5;
+    for (const char *c = namespace; c != NULL && *c != '\0'; ++c) {
+        hash = (hash ^ (uint8_t)*c) * 0x01000193;
     }
-    return err;
+    return hash % NVS_LOCK_SHARDS;
 }
 
-static esp_err_t esp32_nvs_open(const char *namespace, nvs_open_mode_t open_mode, nvs_handle_t *nvs_handle)
+static void nvs_lock_shard(size_t shard)
 {
-    esp_err_t err = nvs_open(namespace, open_mode, nvs_handle); 
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "%s(): Error opening NVS namespace %s: %d (%s)!", __func__, namespace, err, esp_err_to_name(err));
+    if (nvs_shard_mutexes[shard] != NULL) {
+        xSemaphoreTakeRecursive(nvs_shard_mutexes[shard], portMAX_DELAY);
     }
-    return err;
 }
 
-static char* value_to_string(nvs_type_t type_value, const void *value) {
-    char *string_value = NULL;
-    int16_t ret = -1;
+static void nvs_unlock_shard(size_t shard)
+{
+    if (nvs_shard_mutexes[shard] != NULL) {
+        xSemaphoreGiveRecursive(nvs_shard_mutexes[shard]);
+    }
+}
 
-    switch(type_value) {
-        case NVS_TYPE_I8:
-            ret = asprintf(&string_value, "%d", *((int8_t*)value));
-            break;
-        case NVS_TYPE_U8:
-            ret = asprintf(&string_value, "%u", *((uint8_t*)value));
-            break;
-        case NVS_TYPE_I16:
-            ret = asprintf(&string_value, "%d", *((int16_t*)value));
-            break;
-        case NVS_TYPE_U16:
-            ret = asprintf(&string_value, "%u", *((uint16_t*)value));
-            break;
-        case NVS_TYPE_I32:
-            ret = asprintf(&string_value, "%d", *((int32_t*)value));
-            break;
-        case NVS_TYPE_U32:
-            ret = asprintf(&string_value, "%u", *((uint32_t*)value));
-            break;
-        case NVS_TYPE_I64:
-            ret = asprintf(&string_value, "%lld", *((int64_t*)value));
-            break;
-        case NVS_TYPE_U64:
-            ret = asprintf(&string_value, "%llu", *((uint64_t*)value));
-            break;
-        default:
-            ret = asprintf(&string_value, "Unsupported type: %d", type_value);
-            break;
+static void nvs_lock_namespace(const char *namespace)
+{
+    nvs_lock_shard(namespace_shard(namespace));
+}
+
+static void nvs_unlock_namespace(const char *namespace)
+{
+    nvs_unlock_shard(namespace_shard(namespace));
+}
+
+static void nvs_lock(void)
+{
+    for (size_t i = 0; i < NVS_LOCK_SHARDS; ++i) {
+        if (nvs_shard_mutexes[i] != NULL) {
+            xSemaphoreTakeRecursive(nvs_shard_mutexes[i], portMAX_DELAY);
+        }
     }
+}
 
-    if (ret == -1) {
-        string_value = NULL;
-        ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+static void nvs_unlock(void)
+{
+    for (size_t i = NVS_LOCK_SHARDS; i-- > 0;) {
+        if (nvs_shard_mutexes[i] != NULL) {
+            xSemaphoreGiveRecursive(nvs_shard_mutexes[i]);
+        }
     }
-    return string_value;
 }
 
-static esp_err_t esp32_nvs_write(const char *namespace, const char *key, nvs_type_t type_value,
-                                 const void *value, size_t length)
+// Whether another task holds the namespace lock, so the handles of its namespaces may be in use
+static bool shard_busy(size_t shard)
 {
-    if (namespace == NULL) {
-        ESP_LOGE(TAG, "%s(): Failed to write value: namespace is NULL!", __func__);
-        return ESP_ERR_INVALID_ARG;
+    if (nvs_shard_mutexes[shard] == NULL) {
+        return false;
     }
-    if (key == NULL) {
-        ESP_LOGE(TAG, "%s(): Failed to write value: key is NULL!", __func__);
-        return ESP_ERR_INVALID_ARG;
+    TaskHandle_t holder = xSemaphoreGetMutexHolder(nvs_shard_mutexes[shard]);
+    return holder != NULL && holder != xTaskGetCurrentTaskHandle();
+}
+
+static void state_lock(void)
+{
+    if (nvs_state_mutex != NULL) {
+        xSemaphoreTakeRecursive(nvs_state_mutex, portMAX_DELAY);
     }
-    if (value == NULL) {
-        ESP_LOGE(TAG, "%s(): Failed to write NULL value!", __func__);
+}
+
+static void state_unlock(void)
+{
+    if (nvs_state_mutex != NULL) {
+        xSemaphoreGiveRecursive(nvs_state_mutex);
+    }
+}
+
+// NVS encodes the size of the integer types in the low nibble of nvs_type_t
+static size_t scalar_size(nvs_type_t type_value)
+{
+    return (size_t)type_value & 0x0F;
+}
+
+#ifndef NVS_ENABLE_METRICS
+#define NVS_ENABLE_METRICS 0  // 1 to count operations and measure their latency, see nvs_get_metrics()
+#endif
+
+#if NVS_ENABLE_METRICS
+#include "esp_timer.h"
+
+// Wrap metrics code, so it is compiled out when metrics are disabled
+#define NVS_METRIC(statement) do { state_lock(); statement; state_unlock(); } while (0)
+#define NVS_METRIC_START(name) const int64_t name = esp_timer_get_time()
+
+static nvs_metrics_t metrics;  // Protected by the state lock
+
+static const uint32_t HISTOGRAM_LIMITS_US[NVS_METRICS_HISTOGRAM_BUCKETS - 1] = {
+    10, 100, 1000, 5000, 10000, 50000, 100000
+};
+
+static void metrics_add_latency(nvs_latency_histogram_t *histogram, int64_t start_us)
+{
+    uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start_us);
+    size_t bucket = 0;
+    while (bucket < NVS_METRICS_HISTOGRAM_BUCKETS - 1 && elapsed_us >= HISTOGRAM_LIMITS_US[bucket]) {
+        ++bucket;
+    }
+    ++histogram->buckets[bucket];
+    ++histogram->count;
+    histogram->total_us += elapsed_us;
+    if (elapsed_us > histogram->max_us) {
+        histogram->max_us = elapsed_us;
+    }
+}
+
+static void metrics_add_error(esp_err_t err)
+{
+    ++metrics.failures;
+    for (size_t i = 0; i < NVS_METRICS_ERROR_SLOTS; ++i) {
+        if (metrics.errors[i].code == err || metrics.errors[i].code == ESP_OK) {
+            metrics.errors[i].code = err;
+            ++metrics.errors[i].count;
+            return;
+        }
+    }
+    ++metrics.other_errors;
+}
+
+static void metrics_add_read(esp_err_t err, int64_t start_us)
+{
+    ++metrics.reads;
+    metrics_add_latency(&metrics.read_latency, start_us);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        ++metrics.not_found;
+    } else if (err != ESP_OK) {
+        metrics_add_error(err);
+    }
+}
+
+// Bytes a write of the value occupies, as counted in bytes_written
+static size_t metrics_value_size(nvs_type_t type_value, const void *value, size_t length)
+{
+    if (type_value == NVS_TYPE_STR) {
+        return strlen((const char*)value) + 1;
+    }
+    return (type_value == NVS_TYPE_BLOB) ? length : scalar_size(type_value);
+}
+#else
+#define NVS_METRIC(statement) do { } while (0)
+#define NVS_METRIC_START(name) do { } while (0)
+#endif
+
+esp_err_t nvs_get_metrics(nvs_metrics_t *out_metrics)
+{
+#if NVS_ENABLE_METRICS
+    if (out_metrics == NULL) {
         return ESP_ERR_INVALID_ARG;
     }
+    state_lock();
+    *out_metrics = metrics;
+    state_unlock();
+    return ESP_OK;
+#else
+    (void)out_metrics;
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
 
-    nvs_handle_t nvs_handle;
-    esp_err_t err = esp32_nvs_open(namespace, NVS_READWRITE, &nvs_handle);
-    if (err != ESP_OK) {
-        return err;
+void nvs_reset_metrics(void)
+{
+    NVS_METRIC(memset(&metrics, 0, sizeof(metrics)));
+}
+
+#ifndef NVS_HANDLE_CACHE_SIZE
+#define NVS_HANDLE_CACHE_SIZE 8  // Maximum number of namespace handles kept open at the same time
+#endif
+
+typedef struct {
+    bool in_use;
+    char namespace[NVS_KEY_NAME_MAX_SIZE];
+    nvs_open_mode_t open_mode;
+    nvs_handle_t handle;
+    uint32_t last_used;  // Value of handle_cache_clock on the last access, used for LRU eviction
+    bool reserved;       // Being refilled by a task which opens a handle for it without the state lock
+} nvs_handle_cache_entry_t;
+
+/*
+ * Protected by the state lock. An entry is closed only by the holder of its namespace lock or while no other task
+ * holds that lock. When all entries belong to namespaces busy in other tasks, a namespace lock's spare entry at the
+ * end is used. nvs_open() and nvs_close() are called without the state lock: an entry is taken out of the cache and
+ * reserved under it, and the new handle is published under it again.
+ */
+static nvs_handle_cache_entry_t handle_cache[NVS_HANDLE_CACHE_SIZE + NVS_LOCK_SHARDS];
+static uint32_t handle_cache_clock = 0;
+static uint32_t handle_cache_generation = 1;  // Changed whenever a handle is closed, bound keys check it
+
+// Take an entry out of the cache, the state lock has to be taken. The caller closes the handle after releasing it.
+static bool handle_cache_drop_entry(nvs_handle_cache_entry_t *entry, nvs_handle_t *nvs_handle)
+{
+    if (!entry->in_use) {
+        return false;
     }
+    *nvs_handle = entry->handle;
+    entry->in_use = false;
+    ++handle_cache_generation;
+    return true;
+}
 
-    switch (type_value) {
-        case NVS_TYPE_I8:
-            err = nvs_set_i8(nvs_handle, key, *(int8_t*)value);
-            break;
-        case NVS_TYPE_U8:
-            err = nvs_set_u8(nvs_handle, key, *(uint8_t*)value);
-            break;
-        case NVS_TYPE_I16:
-            err = nvs_set_i16(nvs_handle, key, *(int16_t*)value);
-            break;
-        case NVS_TYPE_U16:
-            err = nvs_set_u16(nvs_handle, key, *(uint16_t*)value);
-            break;
-        case NVS_TYPE_I32:
-            err = nvs_set_i32(nvs_handle, key, *(int32_t*)value);
-            break;
-        case NVS_TYPE_U32:
-            err = nvs_set_u32(nvs_handle, key, *(uint32_t*)value);
-            break;
-        case NVS_TYPE_I64:
-            err = nvs_set_i64(nvs_handle, key, *(int64_t*)value);
-            break;
-        case NVS_TYPE_U64:
-            err = nvs_set_u64(nvs_handle, key, *(uint64_t*)value);
-            break;
-        case NVS_TYPE_STR:
-            err = nvs_set_str(nvs_handle, key, (char*)value);
-            break;
-        case NVS_TYPE_BLOB:
-            err = nvs_set_blob(nvs_handle, key, value, length);
-            break;
-        default:
-            err = ESP_ERR_NVS_TYPE_MISMATCH;
-            break;
+static void handle_cache_invalidate(const char *namespace)
+{
+    nvs_handle_t dropped[sizeof(handle_cache) / sizeof(handle_cache[0])];
+    size_t count = 0;
+    state_lock();
+    for (size_t i = 0; i < sizeof(handle_cache) / sizeof(handle_cache[0]); ++i) {
+        if ((namespace == NULL || strcmp(handle_cache[i].namespace, namespace) == 0) &&
+            handle_cache_drop_entry(&handle_cache[i], &dropped[count])) {
+            ++count;
+        }
     }
+    state_unlock();
+    for (size_t i = 0; i < count; ++i) {
+        nvs_close(dropped[i]);
+    }
+}
 
-    if (err == ESP_OK) {
-        err = nvs_commit(nvs_handle);
-        if (err == ESP_OK) {
-            switch (type_value) {
-                case NVS_TYPE_STR:
-                    ESP_LOGI(TAG, "Successfully write string to NVS %s.%s: %s", namespace, key, value);
-                    break;
-                case NVS_TYPE_BLOB:
-                    ESP_LOGI(TAG, "Successfully write blob to NVS %s.%s", namespace, key);
-                    break;
-                default:
-                    #if CONFIG_LOG_MAXIMUM_LEVEL >= CONFIG_LOG_DEFAULT_LEVEL_INFO
-                        char *string_value = value_to_string(type_value, value);
-                        if (string_value != NULL) {
-                            ESP_LOGI(TAG, "Successfully write value to NVS %s.%s: %s", namespace, key, string_value);
-                            free(string_value);
-                        }
-                    #endif  // CONFIG_LOG_MAXIMUM_LEVEL
-                    break;
+#ifndef NVS_VALUE_CACHE_MAX_NAMESPACES
+#define NVS_VALUE_CACHE_MAX_NAMESPACES 4  // Maximum number of namespaces the value cache can be enabled for
+#endif
+
+typedef struct nvs_value_cache_entry_s {
+    struct nvs_value_cache_entry_s *next;
+    char namespace[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_type_t type;
+    size_t length;
+    uint8_t data[];
+} nvs_value_cache_entry_t;
+
+static struct {
+    size_t budget;                    // Maximum number of bytes used by the entries, 0 if the cache is disabled
+    size_t used;
+    nvs_value_cache_entry_t *head;    // The most recently used entry comes first
+    char namespaces[NVS_VALUE_CACHE_MAX_NAMESPACES][NVS_KEY_NAME_MAX_SIZE];
+    uint32_t hits;
+    uint32_t misses;
+} value_cache;
+
+#ifndef NVS_COUNTER_MAX_COUNT
+#define NVS_COUNTER_MAX_COUNT 8  // Maximum number of counters kept in RAM at the same time
+#endif
+#ifndef NVS_COUNTER_SLOTS
+#define NVS_COUNTER_SLOTS 4  // Number of keys a counter is rotated over, at most 10
+#endif
+#if NVS_COUNTER_SLOTS < 1 || NVS_COUNTER_SLOTS > 10
+#error "NVS_COUNTER_SLOTS must be between 1 and 10"
+#endif
+#ifndef NVS_COUNTER_DEFAULT_INTERVAL_MS
+#define NVS_COUNTER_DEFAULT_INTERVAL_MS 60000  // A changed counter is written at most this often by default
+#endif
+
+typedef struct {
+    bool in_use;
+    char namespace[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE - 2];  // Room for the "#<slot>" suffix of the slot keys
+    uint64_t value;
+    uint64_t persisted;                   // Largest value in the slots
+    uint8_t next_slot;                    // The oldest slot, overwritten by the next write
+    TickType_t persisted_at;
+} nvs_counter_t;
+
+/*
+ * Protected by the state lock. A counter is used and written only by the holder of its namespace lock, so counters
+ * of namespaces with different locks are used in parallel.
+ */
+static struct {
+    nvs_counter_t counters[NVS_COUNTER_MAX_COUNT];
+    uint32_t interval_ms;  // 0: no time-based writes
+    uint64_t threshold;    // 0: no threshold-based writes
+} counter_table = { .interval_ms = NVS_COUNTER_DEFAULT_INTERVAL_MS };
+
+/*
+ * Copy a value kept in RAM to the caller with the same semantics as esp32_nvs_get(): strings are either malloc'ed
+ * (length is NULL) or copied to a buffer of *length bytes, blobs are copied to a buffer of *length bytes.
+ */
+static esp_err_t copy_value_out(nvs_type_t type_value, const void *data, size_t data_length,
+                                void *value, size_t *length)
+{
+    esp_err_t err = ESP_OK;
+    if (type_value == NVS_TYPE_STR && length == NULL) {
+        *(char**)value = malloc(data_length);
+        if (*(char**)value != NULL) {
+            memcpy(*(char**)value, data, data_length);
+        } else {
+            err = ESP_ERR_NO_MEM;
+            ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+        }
+    } else if (type_value == NVS_TYPE_STR || type_value == NVS_TYPE_BLOB) {
+        if (value != NULL && *length < data_length) {
+            if (type_value == NVS_TYPE_STR && *length > 0) {
+                ((char*)value)[0] = '\0';
             }
+            err = ESP_ERR_NVS_INVALID_LENGTH;
+        } else if (value != NULL) {
+            memcpy(value, data, data_length);
         }
+        *length = data_length;
     } else {
-        ESP_LOGE(TAG, "Failed to write to NVS %s.%s: %d (%s)!", namespace, key, err, esp_err_to_name(err));
+        memcpy(value, data, data_length);
     }
-
-    nvs_close(nvs_handle);
     return err;
 }
 
-esp_err_t nvs_write_int8(const char *namespace, const char *key, int8_t value)
+// A value copied to RAM until it is written, used by transactions and the write queue
+struct nvs_txn_op_s {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_type_t type;
+    size_t length;
+    union {
+        uint64_t scalar;  // Raw bytes of integer values
+        void *data;       // Heap copy of string and blob values
+    } value;
+    bool unchanged;  // Skipped by the commit because the stored value is the same
+    bool floating;   // A float or double stored as its bit pattern, reported to subscribers as such
+};
+
+static esp_err_t nvs_txn_op_init(struct nvs_txn_op_s *op, const char *key, nvs_type_t type_value,
+                                 const void *value, size_t length)
 {
-    return esp32_nvs_write(namespace, key, NVS_TYPE_I8, &value, 0);
+    if (type_value == NVS_TYPE_STR) {
+        length = strlen((const char*)value) + 1;
+    } else if (type_value != NVS_TYPE_BLOB) {
+        length = scalar_size(type_value);
+    }
+
+    strcpy(op->key, key);
+    op->type = type_value;
+    op->length = length;
+    op->unchanged = false;
+    op->floating = false;
+
+    if (type_value == NVS_TYPE_STR || type_value == NVS_TYPE_BLOB) {
+        op->value.data = malloc((length > 0) ? length : 1);  // An empty blob is valid, malloc(0) may return NULL
+        if (op->value.data == NULL) {
+            ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+            return ESP_ERR_NO_MEM;
+        }
+        memcpy(op->value.data, value, length);
+    } else {
+        op->value.scalar = 0;
+        memcpy(&op->value.scalar, value, length);
+    }
+    return ESP_OK;
 }
 
-esp_err_t nvs_write_uint8(const char *namespace, const char *key, uint8_t value)
+static const void *nvs_txn_op_value(const struct nvs_txn_op_s *op)
 {
-    return esp32_nvs_write(namespace, key, NVS_TYPE_U8, &value, 0);
+    return (op->type == NVS_TYPE_STR || op->type == NVS_TYPE_BLOB) ? op->value.data : &op->value.scalar;
 }
 
-esp_err_t nvs_write_int16(const char *namespace, const char *key, int16_t value)
+static void nvs_txn_op_free(struct nvs_txn_op_s *op)
 {
-    return esp32_nvs_write(namespace, key, NVS_TYPE_I16, &value, 0);
+    if (op->type == NVS_TYPE_STR || op->type == NVS_TYPE_BLOB) {
+        free(op->value.data);
+        op->value.data = NULL;
+    }
 }
 
-esp_err_t nvs_write_uint16(const char *namespace, const char *key, uint16_t value)
+static bool value_cache_enabled(const char *namespace)
 {
-    return esp32_nvs_write(namespace, key, NVS_TYPE_U16, &value, 0);
+    if (value_cache.budget == 0) {
+        return false;
+    }
+    for (size_t i = 0; i < NVS_VALUE_CACHE_MAX_NAMESPACES; ++i) {
+        if (strcmp(value_cache.namespaces[i], namespace) == 0) {
+            return true;
+        }
+    }
+    return false;
 }
 
-esp_err_t nvs_write_int32(const char *namespace, const char *key, int32_t value)
+static void value_cache_remove(nvs_value_cache_entry_t **link)
 {
-    return esp32_nvs_write(namespace, key, NVS_TYPE_I32, &value, 0);
+    nvs_value_cache_entry_t *entry = *link;
+    *link = entry->next;
+    value_cache.used -= sizeof(*entry) + entry->length;
+    free(entry);
 }
 
-esp_err_t nvs_write_uint32(const char *namespace, const char *key, uint32_t value)
+static void value_cache_invalidate(const char *namespace, const char *key)
 {
-    return esp32_nvs_write(namespace, key, NVS_TYPE_U32, &value, 0);
+    state_lock();
+    nvs_value_cache_entry_t **link = &value_cache.head;
+    while (*link != NULL) {
+        if ((namespace == NULL || strcmp((*link)->namespace, namespace) == 0) &&
+            (key == NULL || strcmp((*link)->key, key) == 0)) {
+            value_cache_remove(link);
+        } else {
+            link = &(*link)->next;
+        }
+    }
+    state_unlock();
 }
 
-esp_err_t nvs_write_int64(const char *namespace, const char *key, int64_t value)
+static void value_cache_shrink(size_t budget)
 {
-    return esp32_nvs_write(namespace, key, NVS_TYPE_I64, &value, 0);
+    while (value_cache.used > budget) {
+        nvs_value_cache_entry_t **link = &value_cache.head;
+        while ((*link)->next != NULL) {
+            link = &(*link)->next;
+        }
+        value_cache_remove(link);  // Least recently used
+    }
 }
 
-esp_err_t nvs_write_uint64(const char *namespace, const char *key, uint64_t value)
+// Add a value to a namespace the cache is enabled for, the state lock has to be taken
+static void value_cache_insert(const char *namespace, const char *key, nvs_type_t type_value,
+                               const void *value, size_t length)
 {
-    return esp32_nvs_write(namespace, key, NVS_TYPE_U64, &value, 0);
+    value_cache_invalidate(namespace, key);
+
+    if (type_value == NVS_TYPE_STR) {
+        length = strlen((const char*)value) + 1;
+    } else if (type_value != NVS_TYPE_BLOB) {
+        length = scalar_size(type_value);
+    }
+    if (sizeof(nvs_value_cache_entry_t) + length > value_cache.budget) {
+        return;  // Would never fit
+    }
+    value_cache_shrink(value_cache.budget - sizeof(nvs_value_cache_entry_t) - length);
+
+    nvs_value_cache_entry_t *entry = malloc(sizeof(*entry) + length);
+    if (entry == NULL) {
+        return;  // Not an error, the value is simply read from flash next time
+    }
+    strcpy(entry->namespace, namespace);
+    strcpy(entry->key, key);
+    entry->type = type_value;
+    entry->length = length;
+    memcpy(entry->data, value, length);
+
+    entry->next = value_cache.head;
+    value_cache.head = entry;
+    value_cache.used += sizeof(*entry) + length;
 }
 
-esp_err_t nvs_write_string(const char *namespace, const char *key, const char *value)
+static void value_cache_put(const char *namespace, const char *key, nvs_type_t type_value,
+                            const void *value, size_t length)
 {
-    return esp32_nvs_write(namespace, key, NVS_TYPE_STR, value, 0);
+    state_lock();
+    if (value_cache_enabled(namespace)) {
+        value_cache_insert(namespace, key, type_value, value, length);
+    }
+    state_unlock();
 }
 
-#define MAX_STRING_LENGTH_FOR_FLOAT 32  // Maximum length of the float to string representation
-esp_err_t nvs_write_float(const char *namespace, const char *key, float value)
+// Link to the entry of a key, or to the NULL at the end of the list. The state lock has to be taken
+static nvs_value_cache_entry_t **value_cache_find(const char *namespace, const char *key)
 {
-    char string[MAX_STRING_LENGTH_FOR_FLOAT];
-    int32_t result = snprintf(string, sizeof(string), "%f", value);
-
-    esp_err_t err;
-    if (result >= 0 && result < sizeof(string)) {
-        err = esp32_nvs_write(namespace, key, NVS_TYPE_STR, &string, 0);
-    } else {
-        err = ESP_FAIL;
-        ESP_LOGE(TAG, "%s(): Error occurred during formatting", __func__);
+    nvs_value_cache_entry_t **link = &value_cache.head;
+    while (*link != NULL && (strcmp((*link)->key, key) != 0 || strcmp((*link)->namespace, namespace) != 0)) {
+        link = &(*link)->next;
     }
-    return err;
+    return link;
 }
 
-#define MAX_STRING_LENGTH_FOR_DOUBLE 64  // Maximum length of the double to string representation
-esp_err_t nvs_write_double(const char *namespace, const char *key, double value)
+/*
+ * Serve a read from the cache with the same semantics as esp32_nvs_read().
+ * Return true on a cache hit, the result of the read is stored in err then.
+ */
+static bool value_cache_get(const char *namespace, const char *key, nvs_type_t type_value,
+                            void *value, size_t *length, esp_err_t *err)
 {
-    char string[MAX_STRING_LENGTH_FOR_DOUBLE];
-    int32_t result = snprintf(string, sizeof(string), "%lf", value);
+    state_lock();
+    if (!value_cache_enabled(namespace)) {
+        state_unlock();
+        return false;
+    }
 
-    esp_err_t err;
-    if (result >= 0 && result < sizeof(string)) {
-        err = esp32_nvs_write(namespace, key, NVS_TYPE_STR, &string, 0);
-    } else {
-        err = ESP_FAIL;
-        ESP_LOGE(TAG, "%s(): Error occurred during formatting", __func__);
+    nvs_value_cache_entry_t **link = value_cache_find(namespace, key);
+    nvs_value_cache_entry_t *entry = *link;
+    if (entry == NULL || entry->type != type_value) {
+        ++value_cache.misses;
+        state_unlock();
+        return false;
     }
-    return err;
+    ++value_cache.hits;
+
+    // Move to front
+    *link = entry->next;
+    entry->next = value_cache.head;
+    value_cache.head = entry;
+
+    *err = copy_value_out(type_value, entry->data, entry->length, value, length);
+    state_unlock();
+    return true;
 }
 
-esp_err_t nvs_write_blob(const char *namespace, const char *key, const void *value, size_t length)
+// Copy a cached integer for an internal comparison, without counting a hit or miss and without moving the entry
+static bool value_cache_peek(const char *namespace, const char *key, nvs_type_t type_value, void *value)
 {
-    return esp32_nvs_write(namespace, key, NVS_TYPE_BLOB, value, length);
+    state_lock();
+    const nvs_value_cache_entry_t *entry = value_cache_enabled(namespace) ? *value_cache_find(namespace, key) : NULL;
+    bool found = entry != NULL && entry->type == type_value;
+    if (found) {
+        memcpy(value, entry->data, entry->length);
+    }
+    state_unlock();
+    return found;
 }
 
-static esp_err_t esp32_nvs_read(const char *namespace, const char *key, nvs_type_t type_value,
-                                void *value, size_t length)
+#ifndef NVS_WRITE_HASH_CACHE_SIZE
+#define NVS_WRITE_HASH_CACHE_SIZE 16  // Number of strings and blobs whose stored content is remembered as a hash
+#endif
+
+typedef struct {
+    bool in_use;
+    char namespace[NVS_KEY_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_type_t type;
+    size_t length;
+    uint64_t hash;
+    uint32_t last_used;
+} nvs_write_hash_entry_t;
+
+static nvs_write_hash_entry_t write_hash_cache[NVS_WRITE_HASH_CACHE_SIZE];
+static uint32_t write_hash_clock = 0;
+static bool skip_unchanged_writes = false;
+static uint32_t elided_writes = 0;
+static size_t entries_written = 0;  // Estimate for the idle maintenance, protected by the state lock
+
+// NVS entries taken by a value: one for a scalar, a header and 32-byte data entries for a string or blob
+static size_t value_entries(nvs_type_t type_value, const void *value, size_t length)
 {
-    if (namespace == NULL) {
-        ESP_LOGE(TAG, "%s(): Failed to read value: namespace is NULL!", __func__);
-        return ESP_ERR_INVALID_ARG;
+    if (type_value == NVS_TYPE_STR) {
+        length = strlen((const char*)value) + 1;
+    } else if (type_value != NVS_TYPE_BLOB) {
+        return 1;
     }
-    if (key == NULL) {
-        ESP_LOGE(TAG, "%s(): Failed to read value: key is NULL!", __func__);
-        return ESP_ERR_INVALID_ARG;
+    return 1 + (length + 31) / 32;
+}
+
+// 64-bit FNV-1a
+static uint64_t write_hash(const void *data, size_t length)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= ((const uint8_t*)data)[i];
+        hash *= 0x100000001B3ULL;
     }
-    if (type_value != NVS_TYPE_STR) {
-        if (value == NULL) {
-            ESP_LOGE(TAG, "%s(): Failed to read NULL value!", __func__);
-            return ESP_ERR_INVALID_ARG;
+    return hash;
+}
+
+static nvs_write_hash_entry_t *write_hash_find(const char *namespace, const char *key)
+{
+    for (size_t i = 0; i < NVS_WRITE_HASH_CACHE_SIZE; ++i) {
+        nvs_write_hash_entry_t *entry = &write_hash_cache[i];
+        if (entry->in_use && strcmp(entry->key, key) == 0 && strcmp(entry->namespace, namespace) == 0) {
+            return entry;
         }
     }
+    return NULL;
+}
 
-    nvs_handle_t nvs_handle;
-    esp_err_t err = esp32_nvs_open(namespace, NVS_READONLY, &nvs_handle);
-    if (err != ESP_OK) {
-        return err;
+static void write_hash_invalidate(const char *namespace, const char *key)
+{
+    state_lock();
+    for (size_t i = 0; i < NVS_WRITE_HASH_CACHE_SIZE; ++i) {
+        nvs_write_hash_entry_t *entry = &write_hash_cache[i];
+        if ((namespace == NULL || strcmp(entry->namespace, namespace) == 0) &&
+            (key == NULL || strcmp(entry->key, key) == 0)) {
+            entry->in_use = false;
+        }
     }
+    state_unlock();
+}
 
-    switch (type_value) {
-        case NVS_TYPE_I8:
-            err = nvs_get_i8(nvs_handle, key, (int8_t*)value);
-            break;
-        case NVS_TYPE_U8:
-            err = nvs_get_u8(nvs_handle, key, (uint8_t*)value);
-            break;
-        case NVS_TYPE_I16:
-            err = nvs_get_i16(nvs_handle, key, (int16_t*)value);
+static void write_hash_put(const char *namespace, const char *key, nvs_type_t type_value,
+                           const void *value, size_t length)
+{
+    state_lock();
+    nvs_write_hash_entry_t *entry = write_hash_find(namespace, key);
+    if (entry == NULL) {
+        entry = &write_hash_cache[0];
+        for (size_t i = 0; i < NVS_WRITE_HASH_CACHE_SIZE; ++i) {
+            if (!write_hash_cache[i].in_use) {
+                entry = &write_hash_cache[i];
+                break;
+            }
+            if (write_hash_cache[i].last_used < entry->last_used) {
+                entry = &write_hash_cache[i];
+            }
+        }
+        entry->in_use = true;
+        strcpy(entry->namespace, namespace);
+        strcpy(entry->key, key);
+    }
+    entry->type = type_value;
+    entry->length = length;
+    entry->hash = write_hash(value, length);
+    entry->last_used = ++write_hash_clock;
+    state_unlock();
+}
+
+// Forget everything known about the stored value(s), used when they may have changed in an unknown way
+static void stored_value_invalidate(const char *namespace, const char *key)
+{
+    value_cache_invalidate(namespace, key);
+    write_hash_invalidate(namespace, key);
+}
+
+// Remember a value which was just written or read
+static void stored_value_put(const char *namespace, const char *key, nvs_type_t type_value,
+                             const void *value, size_t length)
+{
+    value_cache_put(namespace, key, type_value, value, length);
+    if (type_value == NVS_TYPE_STR) {
+        write_hash_put(namespace, key, type_value, value, strlen((const char*)value) + 1);
+    } else if (type_value == NVS_TYPE_BLOB) {
+        write_hash_put(namespace, key, type_value, value, length);
+    }
+}
+
+esp_err_t nvs_value_cache_configure(size_t budget)
+{
+    state_lock();
+    value_cache_shrink(budget);
+    value_cache.budget = budget;
+    state_unlock();
+    return ESP_OK;
+}
+
+esp_err_t nvs_value_cache_enable(const char *namespace, bool enable)
+{
+    if (namespace == NULL || strlen(namespace) >= NVS_KEY_NAME_MAX_SIZE) {
+        ESP_LOGE(TAG, "%s(): Invalid namespace!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    state_lock();
+    char (*slot)[NVS_KEY_NAME_MAX_SIZE] = NULL;
+    for (size_t i = 0; i < NVS_VALUE_CACHE_MAX_NAMESPACES; ++i) {
+        if (strcmp(value_cache.namespaces[i], namespace) == 0) {
+            slot = &value_cache.namespaces[i];
+            break;
+        }
+        if (slot == NULL && value_cache.namespaces[i][0] == '\0') {
+            slot = &value_cache.namespaces[i];
+        }
+    }
+
+    esp_err_t err = ESP_OK;
+    if (enable) {
+        if (slot != NULL) {
+            strcpy(*slot, namespace);
+        } else {
+            ESP_LOGE(TAG, "%s(): No free slot for namespace %s!", __func__, namespace);
+            err = ESP_ERR_NO_MEM;
+        }
+    } else if (slot != NULL && strcmp(*slot, namespace) == 0) {
+        value_cache_invalidate(namespace, NULL);
+        (*slot)[0] = '\0';
+    }
+    state_unlock();
+    return err;
+}
+
+void nvs_value_cache_invalidate(const char *namespace, const char *key)
+{
+    stored_value_invalidate(namespace, key);
+}
+
+void nvs_value_cache_get_stats(nvs_value_cache_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    state_lock();
+    stats->hits = value_cache.hits;
+    stats->misses = value_cache.misses;
+    stats->used = value_cache.used;
+    stats->budget = value_cache.budget;
+    state_unlock();
+}
+
+esp_err_t nvs_init(void)
+{
+    if (nvs_state_mutex == NULL) {
+        nvs_state_mutex = xSemaphoreCreateRecursiveMutex();
+        if (nvs_state_mutex == NULL) {
+            ESP_LOGE(TAG, "%s(): Failed to create mutex", __func__);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    for (size_t i = 0; i < NVS_LOCK_SHARDS; ++i) {
+        if (nvs_shard_mutexes[i] == NULL) {
+            nvs_shard_mutexes[i] = xSemaphoreCreateRecursiveMutex();
+            if (nvs_shard_mutexes[i] == NULL) {
+                ESP_LOGE(TAG, "%s(): Failed to create mutex", __func__);
+                return ESP_ERR_NO_MEM;
+            }
+        }
+    }
+
+    nvs_lock();
+    handle_cache_invalidate(NULL);
+    stored_value_invalidate(NULL, NULL);
+
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        err = nvs_flash_init();
+    }
+    nvs_unlock();
+    return err;
+}
+
+esp_err_t nvs_deinit(void)
+{
+    nvs_maintenance_stop();  // Does nothing if the task is not running
+    nvs_counter_flush();
+    nvs_async_stop();  // Write everything still queued, does nothing if the queue is not running
+    nvs_defaults_flush();
+
+    nvs_lock();
+    state_lock();
+    memset(counter_table.counters, 0, sizeof(counter_table.counters));
+    state_unlock();
+    handle_cache_invalidate(NULL);
+    stored_value_invalidate(NULL, NULL);
+    esp_err_t err = nvs_flash_deinit();
+    nvs_unlock();
+    return err;
+}
+
+// Open a namespace through the handle cache without logging, for callers which expect missing namespaces.
+// The namespace lock has to be taken.
+static esp_err_t handle_cache_open(const char *namespace, nvs_open_mode_t open_mode, nvs_handle_t *nvs_handle)
+{
+    state_lock();
+    nvs_handle_cache_entry_t *victim = NULL;
+    ++handle_cache_clock;
+
+    for (size_t i = 0; i < sizeof(handle_cache) / sizeof(handle_cache[0]); ++i) {
+        nvs_handle_cache_entry_t *entry = &handle_cache[i];
+        // A read-write handle is good enough for reading as well
+        if (entry->in_use && (entry->open_mode == open_mode || entry->open_mode == NVS_READWRITE) &&
+            strcmp(entry->namespace, namespace) == 0) {
+            entry->last_used = handle_cache_clock;
+            *nvs_handle = entry->handle;
+            state_unlock();
+            return ESP_OK;
+        }
+        if (i >= NVS_HANDLE_CACHE_SIZE || entry->reserved ||
+            (entry->in_use && shard_busy(namespace_shard(entry->namespace)))) {
+            continue;  // A spare entry, one being refilled, or the handle may be in use by another task
+        }
+        if (victim == NULL || (victim->in_use && (!entry->in_use || entry->last_used < victim->last_used))) {
+            victim = entry;
+        }
+    }
+    if (victim == NULL) {
+        victim = &handle_cache[NVS_HANDLE_CACHE_SIZE + namespace_shard(namespace)];
+    }
+    nvs_handle_t evicted;
+    bool evict = handle_cache_drop_entry(victim, &evicted);
+    victim->reserved = true;
+    state_unlock();
+
+    if (evict) {
+        nvs_close(evicted);
+    }
+    NVS_METRIC_START(open_start);
+    esp_err_t err = nvs_open(namespace, open_mode, nvs_handle);
+    NVS_METRIC(++metrics.opens; metrics_add_latency(&metrics.open_latency, open_start));
+    if (err != ESP_OK) {
+        NVS_METRIC(metrics_add_error(err));
+    }
+
+    // A failed open leaves the entry empty
+    state_lock();
+    victim->reserved = false;
+    if (err == ESP_OK) {
+        victim->in_use = true;
+        strncpy(victim->namespace, namespace, sizeof(victim->namespace) - 1);
+        victim->namespace[sizeof(victim->namespace) - 1] = '\0';
+        victim->open_mode = open_mode;
+        victim->handle = *nvs_handle;
+        victim->last_used = handle_cache_clock;
+    }
+    state_unlock();
+    return err;
+}
+
+static esp_err_t esp32_nvs_open(const char *namespace, nvs_open_mode_t open_mode, nvs_handle_t *nvs_handle)
+{
+    esp_err_t err = handle_cache_open(namespace, open_mode, nvs_handle);
+    // A namespace which doesn't exist yet is a missing value, which the caller reports (or not) as such
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "%s(): Error opening NVS namespace %s: %d (%s)!", __func__, namespace, err, esp_err_to_name(err));
+    }
+    return err;
+}
+
+// Format an integer value into the given buffer for logging, without any allocation
+static const char *value_to_string(nvs_type_t type_value, const void *value, char *string, size_t size)
+{
+    switch(type_value) {
+        case NVS_TYPE_I8:
+            snprintf(string, size, "%" PRId8, *((int8_t*)value));
+            break;
+        case NVS_TYPE_U8:
+            snprintf(string, size, "%" PRIu8, *((uint8_t*)value));
+            break;
+        case NVS_TYPE_I16:
+            snprintf(string, size, "%" PRId16, *((int16_t*)value));
+            break;
+        case NVS_TYPE_U16:
+            snprintf(string, size, "%" PRIu16, *((uint16_t*)value));
+            break;
+        case NVS_TYPE_I32:
+            snprintf(string, size, "%" PRId32, *((int32_t*)value));
+            break;
+        case NVS_TYPE_U32:
+            snprintf(string, size, "%" PRIu32, *((uint32_t*)value));
+            break;
+        case NVS_TYPE_I64:
+            snprintf(string, size, "%" PRId64, *((int64_t*)value));
+            break;
+        case NVS_TYPE_U64:
+            snprintf(string, size, "%" PRIu64, *((uint64_t*)value));
+            break;
+        default:
+            snprintf(string, size, "Unsupported type: %d", type_value);
+            break;
+    }
+    return string;
+}
+
+static esp_err_t get_string_into(nvs_handle_t nvs_handle, const char *key, char *buffer, size_t *length)
+{
+    size_t capacity = *length;
+    // One lookup: on success the string is copied, otherwise nvs_get_str() reports the required size in length
+    esp_err_t err = nvs_get_str(nvs_handle, key, buffer, length);
+    if (err == ESP_ERR_NVS_INVALID_LENGTH && buffer != NULL && capacity > 0) {
+        buffer[0] = '\0';
+    }
+    return err;
+}
+
+/*
+ * For NVS_TYPE_STR, value is a char** receiving a malloc'ed copy of the string if length is NULL. Otherwise it is
+ * a buffer of *length bytes (or NULL to query the size) and no memory is allocated.
+ * For NVS_TYPE_BLOB, length is the size of the buffer on input and the size of the blob on output.
+ */
+static esp_err_t esp32_nvs_get(nvs_handle_t nvs_handle, const char *key, nvs_type_t type_value,
+                               void *value, size_t *length)
+{
+    esp_err_t err;
+    switch (type_value) {
+        case NVS_TYPE_I8:
+            err = nvs_get_i8(nvs_handle, key, (int8_t*)value);
+            break;
+        case NVS_TYPE_U8:
+            err = nvs_get_u8(nvs_handle, key, (uint8_t*)value);
+            break;
+        case NVS_TYPE_I16:
+            err = nvs_get_i16(nvs_handle, key, (int16_t*)value);
             break;
         case NVS_TYPE_U16:
             err = nvs_get_u16(nvs_handle, key, (uint16_t*)value);
@@ -294,6 +959,11 @@ static esp_err_t esp32_nvs_read(const char *namespace, const char *key, nvs_type
             err = nvs_get_u64(nvs_handle, key, (uint64_t*)value);
             break;
         case NVS_TYPE_STR:
+            if (length != NULL) {
+                err = get_string_into(nvs_handle, key, (char*)value, length);
+                break;
+            }
+
             size_t required_string_size = 0;
             err = nvs_get_str(nvs_handle, key, NULL, &required_string_size);
 
@@ -308,114 +978,4126 @@ static esp_err_t esp32_nvs_read(const char *namespace, const char *key, nvs_type
             }
             break;
         case NVS_TYPE_BLOB:
-            size_t required_blob_size = length;
-            err = nvs_get_blob(nvs_handle, key, value, &required_blob_size);
+            err = nvs_get_blob(nvs_handle, key, value, length);
             break;
         default:
             err = ESP_ERR_NVS_TYPE_MISMATCH;
             break;
     }
+    return err;
+}
 
-    switch (err) {
-        case ESP_OK:
-            switch (type_value) {
-                case NVS_TYPE_STR:
-                    ESP_LOGI(TAG, "Successfully read string from NVS %s.%s: %s", namespace, key, *(char**)value);
-                    break;
-                case NVS_TYPE_BLOB:
-                    ESP_LOGI(TAG, "Successfully read blob from NVS %s.%s", namespace, key);
-                    break;
-                default:
-                    #if CONFIG_LOG_MAXIMUM_LEVEL >= CONFIG_LOG_DEFAULT_LEVEL_INFO
-                        char *string_value = value_to_string(type_value, value);
-                        if (string_value != NULL) {
-                            ESP_LOGI(TAG, "Successfully read value from NVS %s.%s: %s", namespace, key, string_value);
-                            free(string_value);
-                        }
-                    #endif  // CONFIG_LOG_MAXIMUM_LEVEL
-                    break;
-            }
+static esp_err_t esp32_nvs_set(nvs_handle_t nvs_handle, const char *key, nvs_type_t type_value,
+                               const void *value, size_t length)
+{
+    esp_err_t err;
+    switch (type_value) {
+        case NVS_TYPE_I8:
+            err = nvs_set_i8(nvs_handle, key, *(int8_t*)value);
             break;
-        case ESP_ERR_NVS_NOT_FOUND:
-            ESP_LOGW(TAG, "Value %s.%s is not initialized yet", namespace, key);
+        case NVS_TYPE_U8:
+            err = nvs_set_u8(nvs_handle, key, *(uint8_t*)value);
+            break;
+        case NVS_TYPE_I16:
+            err = nvs_set_i16(nvs_handle, key, *(int16_t*)value);
+            break;
+        case NVS_TYPE_U16:
+            err = nvs_set_u16(nvs_handle, key, *(uint16_t*)value);
+            break;
+        case NVS_TYPE_I32:
+            err = nvs_set_i32(nvs_handle, key, *(int32_t*)value);
+            break;
+        case NVS_TYPE_U32:
+            err = nvs_set_u32(nvs_handle, key, *(uint32_t*)value);
+            break;
+        case NVS_TYPE_I64:
+            err = nvs_set_i64(nvs_handle, key, *(int64_t*)value);
+            break;
+        case NVS_TYPE_U64:
+            err = nvs_set_u64(nvs_handle, key, *(uint64_t*)value);
+            break;
+        case NVS_TYPE_STR:
+            err = nvs_set_str(nvs_handle, key, (char*)value);
+            break;
+        case NVS_TYPE_BLOB:
+            err = nvs_set_blob(nvs_handle, key, value, length);
             break;
         default:
-            ESP_LOGE(TAG, "Failed to read from NVS %s.%s: %d (%s)", namespace, key, err, esp_err_to_name(err));
+            err = ESP_ERR_NVS_TYPE_MISMATCH;
             break;
     }
-    
-    nvs_close(nvs_handle);
     return err;
 }
 
-esp_err_t nvs_read_int8(const char *namespace, const char *key, void *out_value)
+/*
+ * Check whether the stored value equals the given one. Integers are compared with the stored value, strings and
+ * blobs with the remembered hash or, if there is none, with the stored content.
+ */
+static bool value_unchanged(nvs_handle_t nvs_handle, const char *namespace, const char *key, nvs_type_t type_value,
+                            const void *value, size_t length)
 {
-    return esp32_nvs_read(namespace, key, NVS_TYPE_I8, out_value, 0);
-}
+    if (type_value != NVS_TYPE_STR && type_value != NVS_TYPE_BLOB) {
+        uint64_t current = 0;
+        esp_err_t err = ESP_OK;
+        if (!value_cache_peek(namespace, key, type_value, &current)) {
+            err = esp32_nvs_get(nvs_handle, key, type_value, &current, NULL);
+        }
+        return err == ESP_OK && memcmp(&current, value, scalar_size(type_value)) == 0;
+    }
 
-esp_err_t nvs_read_uint8(const char *namespace, const char *key, void *out_value)
-{
-    return esp32_nvs_read(namespace, key, NVS_TYPE_U8, out_value, 0);
+    if (type_value == NVS_TYPE_STR) {
+        length = strlen((const char*)value) + 1;
+    }
+
+    state_lock();
+    const nvs_write_hash_entry_t *entry = write_hash_find(namespace, key);
+    bool known = entry != NULL;
+    bool unchanged = known && entry->type == type_value && entry->length == length &&
+                     entry->hash == write_hash(value, length);
+    state_unlock();
+    if (known) {
+        return unchanged;
+    }
+
+    size_t stored_length = 0;
+    if (esp32_nvs_get(nvs_handle, key, type_value, NULL, &stored_length) != ESP_OK || stored_length != length) {
+        return false;
+    }
+    void *stored = malloc(stored_length);
+    if (stored == NULL) {
+        return false;  // Can't compare, just write
+    }
+    unchanged = esp32_nvs_get(nvs_handle, key, type_value, stored, &stored_length) == ESP_OK &&
+                stored_length == length && memcmp(stored, value, length) == 0;
+    if (unchanged) {
+        write_hash_put(namespace, key, type_value, stored, stored_length);
+    }
+    free(stored);
+    return unchanged;
 }
 
-esp_err_t nvs_read_int16(const char *namespace, const char *key, void *out_value)
+// Write through an open read-write handle, the arguments are checked by the caller
+static esp_err_t esp32_nvs_write_handle(nvs_handle_t nvs_handle, const char *namespace, const char *key,
+                                        nvs_type_t type_value, const void *value, size_t length, bool skip_unchanged)
 {
-    return esp32_nvs_read(namespace, key, NVS_TYPE_I16, out_value, 0);
+    if (skip_unchanged && value_unchanged(nvs_handle, namespace, key, type_value, value, length)) {
+        state_lock();
+        ++elided_writes;
+        state_unlock();
+        NVS_LOGD(WRITE, "Value %s.%s is unchanged, write skipped", namespace, key);
+        return NVS_WRITE_UNCHANGED;
+    }
+
+    NVS_METRIC_START(write_start);
+    esp_err_t err = esp32_nvs_set(nvs_handle, key, type_value, value, length);
+
+    if (err == ESP_OK) {
+        state_lock();
+        entries_written += value_entries(type_value, value, length);
+        state_unlock();
+        err = nvs_commit(nvs_handle);
+        NVS_METRIC(++metrics.commits);
+        if (err == ESP_OK) {
+            NVS_METRIC(++metrics.writes; metrics.bytes_written += metrics_value_size(type_value, value, length);
+                       metrics_add_latency(&metrics.write_latency, write_start));
+            stored_value_put(namespace, key, type_value, value, length);
+            switch (type_value) {
+                case NVS_TYPE_STR:
+                    NVS_LOGI(WRITE, "Successfully write string to NVS %s.%s: %.*s", namespace, key,
+                             NVS_LOG_STRING_MAX_LENGTH, (const char*)value);
+                    break;
+                case NVS_TYPE_BLOB:
+                    NVS_LOGI(WRITE, "Successfully write blob to NVS %s.%s", namespace, key);
+                    break;
+                default: {
+                    char string_value[VALUE_STRING_SIZE];
+                    NVS_LOGI(WRITE, "Successfully write value to NVS %s.%s: %s", namespace, key,
+                             value_to_string(type_value, value, string_value, sizeof(string_value)));
+                    break;
+                }
+            }
+        }
+    } else {
+        ESP_LOGE(TAG, "Failed to write to NVS %s.%s: %d (%s)!", namespace, key, err, esp_err_to_name(err));
+    }
+
+    if (err != ESP_OK) {
+        NVS_METRIC(metrics_add_error(err));
+        stored_value_invalidate(namespace, key);  // The stored value is unknown now
+    }
+    if (err == ESP_ERR_NVS_INVALID_HANDLE) {
+        handle_cache_invalidate(namespace);
+    }
+    return err;
 }
 
-esp_err_t nvs_read_uint16(const char *namespace, const char *key, void *out_value)
+// Return NVS_WRITE_UNCHANGED instead of writing if skip_unchanged is set and the stored value is the same
+static esp_err_t esp32_nvs_write_value(const char *namespace, const char *key, nvs_type_t type_value,
+                                       const void *value, size_t length, bool skip_unchanged)
 {
-    return esp32_nvs_read(namespace, key, NVS_TYPE_U16, out_value, 0);
+    if (namespace == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to write value: namespace is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (key == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to write value: key is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (value == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to write NULL value!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    nvs_handle_t nvs_handle;
+    esp_err_t err = esp32_nvs_open(namespace, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return esp32_nvs_write_handle(nvs_handle, namespace, key, type_value, value, length, skip_unchanged);
 }
 
-esp_err_t nvs_read_int32(const char *namespace, const char *key, void *out_value)
+#define WRITE_QUEUE_PENDING_BIT (1 << 0)  // At least one write is queued
+#define WRITE_QUEUE_SPACE_BIT   (1 << 1)  // The queue is not full
+#define WRITE_QUEUE_IDLE_BIT    (1 << 2)  // Nothing is queued or being written
+#define WRITE_QUEUE_STOP_BIT    (1 << 3)  // The worker has to exit once the queue is empty
+#define WRITE_QUEUE_EXITED_BIT  (1 << 4)  // The worker has exited
+
+typedef struct {
+    char namespace[NVS_KEY_NAME_MAX_SIZE];
+    struct nvs_txn_op_s op;
+} nvs_write_queue_entry_t;
+
+/*
+ * Writes queued by nvs_write_*() while nvs_async_start() is in effect, oldest first. The entries are protected by
+ * the lock, which is only held for a short time so writers are never blocked by flash operations. The worker takes
+ * namespace lock before the lock, so a value is visible either in the queue or in NVS to a reader taking it.
+ */
+static struct {
+    SemaphoreHandle_t lock;
+    EventGroupHandle_t events;
+    nvs_async_config_t config;
+    bool running;
+    bool in_flight;                    // The worker is writing an entry which is already removed from the queue
+    nvs_write_queue_entry_t *entries;  // config.queue_length entries
+    size_t count;
+} write_queue;
+
+// Has to be called with write_queue.lock taken
+static void write_queue_update_bits(void)
 {
-    return esp32_nvs_read(namespace, key, NVS_TYPE_I32, out_value, 0);
+    EventBits_t bits = 0;
+    if (write_queue.count > 0) {
+        bits |= WRITE_QUEUE_PENDING_BIT;
+    }
+    if (write_queue.count < write_queue.config.queue_length) {
+        bits |= WRITE_QUEUE_SPACE_BIT;
+    }
+    if (write_queue.count == 0 && !write_queue.in_flight) {
+        bits |= WRITE_QUEUE_IDLE_BIT;
+    }
+    xEventGroupClearBits(write_queue.events,
+                         (WRITE_QUEUE_PENDING_BIT | WRITE_QUEUE_SPACE_BIT | WRITE_QUEUE_IDLE_BIT) & ~bits);
+    xEventGroupSetBits(write_queue.events, bits);
 }
 
-esp_err_t nvs_read_uint32(const char *namespace, const char *key, void *out_value)
+// Has to be called with write_queue.lock taken
+static nvs_write_queue_entry_t *write_queue_find(const char *namespace, const char *key)
 {
-    return esp32_nvs_read(namespace, key, NVS_TYPE_U32, out_value, 0);
+    for (size_t i = 0; i < write_queue.count; ++i) {
+        nvs_write_queue_entry_t *entry = &write_queue.entries[i];
+        if (strcmp(entry->op.key, key) == 0 && strcmp(entry->namespace, namespace) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
 }
 
-esp_err_t nvs_read_int64(const char *namespace, const char *key, void *out_value)
+// Has to be called with write_queue.lock taken
+static void write_queue_remove(size_t index)
 {
-    return esp32_nvs_read(namespace, key, NVS_TYPE_I64, out_value, 0);
+    nvs_txn_op_free(&write_queue.entries[index].op);
+    memmove(&write_queue.entries[index], &write_queue.entries[index + 1],
+            (write_queue.count - index - 1) * sizeof(write_queue.entries[0]));
+    --write_queue.count;
 }
 
-esp_err_t nvs_read_uint64(const char *namespace, const char *key, void *out_value)
+/*
+ * Queue a write if the queue is running. A pending write to the same key is replaced and keeps its place in the
+ * queue. Return false if the value has to be written synchronously, otherwise the result is stored in err.
+ */
+static bool write_queue_push(const char *namespace, const char *key, nvs_type_t type_value,
+                             const void *value, size_t length, esp_err_t *err)
 {
-    return esp32_nvs_read(namespace, key, NVS_TYPE_U64, out_value, 0);
+    if (write_queue.lock == NULL || namespace == NULL || key == NULL || value == NULL ||
+        strlen(namespace) >= NVS_KEY_NAME_MAX_SIZE || strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+        return false;  // Invalid arguments are reported by the synchronous write
+    }
+
+    TickType_t start = xTaskGetTickCount();
+    xSemaphoreTake(write_queue.lock, portMAX_DELAY);
+    nvs_write_queue_entry_t *entry = NULL;
+    while (write_queue.running) {
+        entry = write_queue_find(namespace, key);
+        if (entry != NULL || write_queue.count < write_queue.config.queue_length) {
+            break;
+        }
+
+        // The queue is full
+        TickType_t timeout = pdMS_TO_TICKS(write_queue.config.block_timeout_ms);
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (write_queue.config.backpressure == NVS_ASYNC_WRITE_THROUGH) {
+            break;
+        }
+        if (write_queue.config.backpressure == NVS_ASYNC_REJECT || elapsed >= timeout) {
+            xSemaphoreGive(write_queue.lock);
+            ESP_LOGE(TAG, "%s(): Write queue is full, %s.%s is not written!", __func__, namespace, key);
+            *err = (write_queue.config.backpressure == NVS_ASYNC_REJECT) ? ESP_ERR_NO_MEM : ESP_ERR_TIMEOUT;
+            return true;
+        }
+        xSemaphoreGive(write_queue.lock);
+        xEventGroupWaitBits(write_queue.events, WRITE_QUEUE_SPACE_BIT, pdFALSE, pdFALSE, timeout - elapsed);
+        xSemaphoreTake(write_queue.lock, portMAX_DELAY);
+    }
+    if (!write_queue.running || (entry == NULL && write_queue.count == write_queue.config.queue_length)) {
+        xSemaphoreGive(write_queue.lock);
+        return false;
+    }
+
+    struct nvs_txn_op_s op;
+    *err = nvs_txn_op_init(&op, key, type_value, value, length);
+    if (*err == ESP_OK) {
+        if (entry != NULL) {
+            nvs_txn_op_free(&entry->op);  // Coalesced, only the latest value is written
+        } else {
+            entry = &write_queue.entries[write_queue.count++];
+            strcpy(entry->namespace, namespace);
+        }
+        entry->op = op;
+        write_queue_update_bits();
+        NVS_LOGD(WRITE, "Write to NVS %s.%s queued", namespace, key);
+    }
+    xSemaphoreGive(write_queue.lock);
+    return true;
 }
 
-esp_err_t nvs_read_string(const char *namespace, const char *key, void *out_value)
+/*
+ * Serve a read of a queued value with the same semantics as value_cache_get(). A queued value of another type
+ * replaces the stored one once written, so the read fails with ESP_ERR_NVS_TYPE_MISMATCH as it will after the flush.
+ */
+static bool write_queue_get(const char *namespace, const char *key, nvs_type_t type_value,
+                            void *value, size_t *length, esp_err_t *err)
 {
-    return esp32_nvs_read(namespace, key, NVS_TYPE_STR, out_value, 0);
+    if (write_queue.lock == NULL) {
+        return false;
+    }
+
+    xSemaphoreTake(write_queue.lock, portMAX_DELAY);
+    const nvs_write_queue_entry_t *entry = write_queue_find(namespace, key);
+    if (entry != NULL && entry->op.type != type_value) {
+        *err = ESP_ERR_NVS_TYPE_MISMATCH;
+    } else if (entry != NULL) {
+        *err = copy_value_out(type_value, nvs_txn_op_value(&entry->op), entry->op.length, value, length);
+    }
+    xSemaphoreGive(write_queue.lock);
+    return entry != NULL;
 }
 
-esp_err_t nvs_read_float(const char *namespace, const char *key, void *out_value)
+// Type and length (as nvs_key_exists() reports them) of a queued value
+static bool write_queue_stat(const char *namespace, const char *key, nvs_type_t *type_value, size_t *length)
 {
-    char *string = NULL;
-    esp_err_t err = esp32_nvs_read(namespace, key, NVS_TYPE_STR, &string, 0);
+    if (write_queue.lock == NULL) {
+        return false;
+    }
+
+    xSemaphoreTake(write_queue.lock, portMAX_DELAY);
+    const nvs_write_queue_entry_t *entry = write_queue_find(namespace, key);
+    if (entry != NULL) {
+        *type_value = entry->op.type;
+        *length = entry->op.length;
+    }
+    xSemaphoreGive(write_queue.lock);
+    return entry != NULL;
+}
+
+// Whether writes to the namespace are queued
+static bool write_queue_has_namespace(const char *namespace)
+{
+    if (write_queue.lock == NULL) {
+        return false;
+    }
+
+    xSemaphoreTake(write_queue.lock, portMAX_DELAY);
+    bool found = false;
+    for (size_t i = 0; i < write_queue.count && !found; ++i) {
+        found = strcmp(write_queue.entries[i].namespace, namespace) == 0;
+    }
+    xSemaphoreGive(write_queue.lock);
+    return found;
+}
+
+/*
+ * Drop the queued writes to a key (or to the whole namespace if key is NULL) which are superseded by a synchronous
+ * operation. Has to be called with the namespace lock taken, so the worker is not writing one of them meanwhile.
+ */
+static void write_queue_drop(const char *namespace, const char *key)
+{
+    if (write_queue.lock == NULL || namespace == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(write_queue.lock, portMAX_DELAY);
+    for (size_t i = write_queue.count; i-- > 0;) {
+        const nvs_write_queue_entry_t *entry = &write_queue.entries[i];
+        if (strcmp(entry->namespace, namespace) == 0 && (key == NULL || strcmp(entry->op.key, key) == 0)) {
+            write_queue_remove(i);
+        }
+    }
+    write_queue_update_bits();
+    xSemaphoreGive(write_queue.lock);
+}
+
+static void write_queue_task(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        xEventGroupWaitBits(write_queue.events, WRITE_QUEUE_PENDING_BIT | WRITE_QUEUE_STOP_BIT,
+                            pdFALSE, pdFALSE, portMAX_DELAY);
+
+        // The namespace lock comes before the queue lock, so peek at the namespace of the oldest entry first
+        char namespace[NVS_KEY_NAME_MAX_SIZE];
+        xSemaphoreTake(write_queue.lock, portMAX_DELAY);
+        if (write_queue.count == 0) {
+            bool stop = (xEventGroupGetBits(write_queue.events) & WRITE_QUEUE_STOP_BIT) != 0;
+            xSemaphoreGive(write_queue.lock);
+            if (stop) {
+                break;
+            }
+            continue;
+        }
+        strcpy(namespace, write_queue.entries[0].namespace);
+        xSemaphoreGive(write_queue.lock);
+
+        nvs_lock_namespace(namespace);
+        xSemaphoreTake(write_queue.lock, portMAX_DELAY);
+        size_t index = 0;
+        while (index < write_queue.count && strcmp(write_queue.entries[index].namespace, namespace) != 0) {
+            ++index;
+        }
+        if (index == write_queue.count) {
+            // Dropped by a synchronous write in the meantime
+            xSemaphoreGive(write_queue.lock);
+            nvs_unlock_namespace(namespace);
+            continue;
+        }
+        nvs_write_queue_entry_t entry = write_queue.entries[index];
+        --write_queue.count;
+        memmove(&write_queue.entries[index], &write_queue.entries[index + 1],
+                (write_queue.count - index) * sizeof(entry));
+        write_queue.in_flight = true;
+        write_queue_update_bits();
+        nvs_async_callback_t callback = write_queue.config.callback;
+        void *callback_ctx = write_queue.config.callback_ctx;
+        xSemaphoreGive(write_queue.lock);
+
+        esp_err_t err = esp32_nvs_write_value(entry.namespace, entry.op.key, entry.op.type,
+                                              nvs_txn_op_value(&entry.op), entry.op.length, skip_unchanged_writes);
+        nvs_unlock_namespace(namespace);
+
+        if (callback != NULL) {
+            callback(entry.namespace, entry.op.key, (err == NVS_WRITE_UNCHANGED) ? ESP_OK : err, callback_ctx);
+        }
+        nvs_txn_op_free(&entry.op);
+
+        xSemaphoreTake(write_queue.lock, portMAX_DELAY);
+        write_queue.in_flight = false;
+        write_queue_update_bits();
+        xSemaphoreGive(write_queue.lock);
+    }
+
+    xEventGroupSetBits(write_queue.events, WRITE_QUEUE_EXITED_BIT);
+    vTaskDelete(NULL);
+}
+
+esp_err_t nvs_async_start(const nvs_async_config_t *config)
+{
+    if (config == NULL || config->queue_length == 0) {
+        ESP_LOGE(TAG, "%s(): Invalid configuration!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (write_queue.lock == NULL) {
+        write_queue.lock = xSemaphoreCreateMutex();
+        write_queue.events = xEventGroupCreate();
+        if (write_queue.lock == NULL || write_queue.events == NULL) {
+            ESP_LOGE(TAG, "%s(): Failed to create the write queue", __func__);
+            return ESP_ERR_NO_MEM;  // The ones which could be created are reused by the next call
+        }
+    }
+
+    xSemaphoreTake(write_queue.lock, portMAX_DELAY);
+    if (write_queue.running) {
+        xSemaphoreGive(write_queue.lock);
+        ESP_LOGE(TAG, "%s(): Write queue is already running!", __func__);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t err = ESP_OK;
+    write_queue.entries = calloc(config->queue_length, sizeof(write_queue.entries[0]));
+    if (write_queue.entries == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+        err = ESP_ERR_NO_MEM;
+    } else {
+        write_queue.config = *config;
+        write_queue.count = 0;
+        write_queue.in_flight = false;
+        xEventGroupClearBits(write_queue.events, WRITE_QUEUE_STOP_BIT | WRITE_QUEUE_EXITED_BIT);
+        write_queue_update_bits();
+        if (xTaskCreate(write_queue_task, "nvs_write_queue", config->task_stack_size, NULL,
+                        config->task_priority, NULL) == pdPASS) {
+            write_queue.running = true;
+        } else {
+            ESP_LOGE(TAG, "%s(): Failed to create the write queue task", __func__);
+            free(write_queue.entries);
+            write_queue.entries = NULL;
+            err = ESP_ERR_NO_MEM;
+        }
+    }
+    xSemaphoreGive(write_queue.lock);
+    return err;
+}
+
+esp_err_t nvs_async_stop(void)
+{
+    if (write_queue.lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Writes go straight to NVS from now on, the worker writes what is already queued and exits
+    xSemaphoreTake(write_queue.lock, portMAX_DELAY);
+    bool running = write_queue.running;
+    write_queue.running = false;
+    xSemaphoreGive(write_queue.lock);
+    if (!running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xEventGroupSetBits(write_queue.events, WRITE_QUEUE_STOP_BIT);
+    xEventGroupWaitBits(write_queue.events, WRITE_QUEUE_EXITED_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+
+    xSemaphoreTake(write_queue.lock, portMAX_DELAY);
+    free(write_queue.entries);
+    write_queue.entries = NULL;
+    xSemaphoreGive(write_queue.lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_flush(uint32_t timeout_ms)
+{
+    if (write_queue.events == NULL) {
+        return ESP_OK;  // Nothing has ever been queued
+    }
+
+    EventBits_t bits = xEventGroupWaitBits(write_queue.events, WRITE_QUEUE_IDLE_BIT, pdFALSE, pdFALSE,
+                                           pdMS_TO_TICKS(timeout_ms));
+    if ((bits & WRITE_QUEUE_IDLE_BIT) == 0) {
+        ESP_LOGW(TAG, "%s(): Write queue is not empty after %" PRIu32 " ms", __func__, timeout_ms);
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+#ifndef NVS_SUBSCRIPTIONS_MAX
+#define NVS_SUBSCRIPTIONS_MAX 8  // Subscriptions of nvs_subscribe() at the same time
+#endif
+
+typedef struct {
+    bool in_use;
+    bool prefix;                            // key is a prefix, an empty one matches every key
+    char namespace[NVS_KEY_NAME_MAX_SIZE];  // Empty for every namespace
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_change_callback_t callback;
+    void *ctx;
+} nvs_subscription_t;
+
+typedef struct {
+    nvs_change_callback_t callback;
+    void *ctx;
+} nvs_subscriber_t;
+
+static nvs_subscription_t subscriptions[NVS_SUBSCRIPTIONS_MAX];  // Protected by the state lock
+static volatile size_t subscription_count = 0;  // Read without the lock, so writes skip dispatch when it is 0
+
+static bool subscription_matches(const nvs_subscription_t *subscription, const char *namespace, const char *key)
+{
+    if (subscription->namespace[0] != '\0' && strcmp(subscription->namespace, namespace) != 0) {
+        return false;
+    }
+    if (key == NULL) {
+        return true;  // The whole namespace was erased
+    }
+    return subscription->prefix ? strncmp(key, subscription->key, strlen(subscription->key)) == 0
+                                : strcmp(key, subscription->key) == 0;
+}
+
+/*
+ * Call the subscribers of a changed key. The callbacks may use any namespace, so no namespace lock may be taken;
+ * they are copied under the state lock and called without it.
+ */
+static void subscriptions_notify(const char *namespace, const char *key, nvs_type_t type_value,
+                                 const void *value, size_t length)
+{
+    if (subscription_count == 0) {
+        return;
+    }
+
+    nvs_subscriber_t subscribers[NVS_SUBSCRIPTIONS_MAX];
+    size_t count = 0;
+    state_lock();
+    for (size_t i = 0; i < NVS_SUBSCRIPTIONS_MAX; ++i) {
+        if (subscriptions[i].in_use && subscription_matches(&subscriptions[i], namespace, key)) {
+            subscribers[count].callback = subscriptions[i].callback;
+            subscribers[count].ctx = subscriptions[i].ctx;
+            ++count;
+        }
+    }
+    state_unlock();
+
+    if (type_value == NVS_TYPE_STR && value != NULL) {
+        length = strlen((const char*)value) + 1;
+    } else if (type_value != NVS_TYPE_BLOB && type_value != NVS_TYPE_ANY) {
+        length = scalar_size(type_value);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        subscribers[i].callback(namespace, key, type_value, value, length, subscribers[i].ctx);
+    }
+}
+
+esp_err_t nvs_subscribe(const char *namespace, const char *key_or_prefix, nvs_change_callback_t callback, void *ctx)
+{
+    if (key_or_prefix == NULL) {
+        key_or_prefix = "*";
+    }
+    const char *star = strchr(key_or_prefix, '*');
+    if (callback == NULL || (namespace != NULL && strlen(namespace) >= NVS_KEY_NAME_MAX_SIZE) ||
+        strlen(key_or_prefix) >= NVS_KEY_NAME_MAX_SIZE || (star != NULL && star[1] != '\0')) {
+        ESP_LOGE(TAG, "%s(): Invalid subscription!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = ESP_ERR_NO_MEM;
+    state_lock();
+    for (size_t i = 0; i < NVS_SUBSCRIPTIONS_MAX; ++i) {
+        nvs_subscription_t *subscription = &subscriptions[i];
+        if (!subscription->in_use) {
+            memset(subscription, 0, sizeof(*subscription));
+            if (namespace != NULL) {
+                strcpy(subscription->namespace, namespace);
+            }
+            subscription->prefix = star != NULL;
+            memcpy(subscription->key, key_or_prefix, (star != NULL) ? (size_t)(star - key_or_prefix)
+                                                                    : strlen(key_or_prefix));
+            subscription->callback = callback;
+            subscription->ctx = ctx;
+            subscription->in_use = true;
+            ++subscription_count;
+            err = ESP_OK;
+            break;
+        }
+    }
+    state_unlock();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s(): All %d subscriptions are in use!", __func__, NVS_SUBSCRIPTIONS_MAX);
+    }
+    return err;
+}
+
+esp_err_t nvs_unsubscribe(nvs_change_callback_t callback, void *ctx)
+{
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    state_lock();
+    for (size_t i = 0; i < NVS_SUBSCRIPTIONS_MAX; ++i) {
+        if (subscriptions[i].in_use && subscriptions[i].callback == callback && subscriptions[i].ctx == ctx) {
+            subscriptions[i].in_use = false;
+            --subscription_count;
+            err = ESP_OK;
+        }
+    }
+    state_unlock();
+    return err;
+}
+
+// nvs_write_*() without notifying subscribers, for internal keys and for calls which report another value.
+// NVS_WRITE_UNCHANGED if the write was skipped.
+static esp_err_t esp32_nvs_store(const char *namespace, const char *key, nvs_type_t type_value,
+                                 const void *value, size_t length)
+{
+    esp_err_t err;
+    if (!write_queue_push(namespace, key, type_value, value, length, &err)) {
+        nvs_lock_namespace(namespace);
+        if (key != NULL) {
+            write_queue_drop(namespace, key);
+        }
+        err = esp32_nvs_write_value(namespace, key, type_value, value, length, skip_unchanged_writes);
+        nvs_unlock_namespace(namespace);
+    }
+    return err;
+}
+
+// Report the result of a public write: the value the caller passed, once, unless the write was skipped
+static esp_err_t write_reported(esp_err_t err, const char *namespace, const char *key, nvs_type_t type_value,
+                                const void *value, size_t length)
+{
+    if (err == NVS_WRITE_UNCHANGED) {
+        return ESP_OK;
+    }
+    if (err == ESP_OK) {
+        subscriptions_notify(namespace, key, type_value, value, length);
+    }
+    return err;
+}
+
+static esp_err_t esp32_nvs_write(const char *namespace, const char *key, nvs_type_t type_value,
+                                 const void *value, size_t length)
+{
+    esp_err_t err = esp32_nvs_store(namespace, key, type_value, value, length);
+    return write_reported(err, namespace, key, type_value, value, length);
+}
+
+void nvs_set_skip_unchanged(bool enable)
+{
+    skip_unchanged_writes = enable;
+}
+
+// nvs_write_if_changed() without notifying subscribers, for internal keys written with the namespace lock taken
+static esp_err_t esp32_nvs_write_if_changed(const char *namespace, const char *key, nvs_type_t type_value,
+                                           const void *value, size_t length)
+{
+    nvs_lock_namespace(namespace);
+    if (key != NULL) {
+        write_queue_drop(namespace, key);
+    }
+    esp_err_t err = esp32_nvs_write_value(namespace, key, type_value, value, length, true);
+    nvs_unlock_namespace(namespace);
+    return err;
+}
+
+esp_err_t nvs_write_if_changed(const char *namespace, const char *key, nvs_type_t type_value,
+                               const void *value, size_t length)
+{
+    esp_err_t err = esp32_nvs_write_if_changed(namespace, key, type_value, value, length);
+    if (err == ESP_OK) {
+        subscriptions_notify(namespace, key, type_value, value, length);
+    }
+    return err;
+}
+
+uint32_t nvs_get_elided_writes(void)
+{
+    return elided_writes;
+}
+
+esp_err_t nvs_write_int8(const char *namespace, const char *key, int8_t value)
+{
+    return esp32_nvs_write(namespace, key, NVS_TYPE_I8, &value, 0);
+}
+
+esp_err_t nvs_write_uint8(const char *namespace, const char *key, uint8_t value)
+{
+    return esp32_nvs_write(namespace, key, NVS_TYPE_U8, &value, 0);
+}
+
+esp_err_t nvs_write_int16(const char *namespace, const char *key, int16_t value)
+{
+    return esp32_nvs_write(namespace, key, NVS_TYPE_I16, &value, 0);
+}
+
+esp_err_t nvs_write_uint16(const char *namespace, const char *key, uint16_t value)
+{
+    return esp32_nvs_write(namespace, key, NVS_TYPE_U16, &value, 0);
+}
+
+esp_err_t nvs_write_int32(const char *namespace, const char *key, int32_t value)
+{
+    return esp32_nvs_write(namespace, key, NVS_TYPE_I32, &value, 0);
+}
+
+esp_err_t nvs_write_uint32(const char *namespace, const char *key, uint32_t value)
+{
+    return esp32_nvs_write(namespace, key, NVS_TYPE_U32, &value, 0);
+}
+
+esp_err_t nvs_write_int64(const char *namespace, const char *key, int64_t value)
+{
+    return esp32_nvs_write(namespace, key, NVS_TYPE_I64, &value, 0);
+}
+
+esp_err_t nvs_write_uint64(const char *namespace, const char *key, uint64_t value)
+{
+    return esp32_nvs_write(namespace, key, NVS_TYPE_U64, &value, 0);
+}
+
+esp_err_t nvs_write_string(const char *namespace, const char *key, const char *value)
+{
+    return esp32_nvs_write(namespace, key, NVS_TYPE_STR, value, 0);
+}
+
+// Floating values are stored and queued as their bit pattern, subscribers get the value
+esp_err_t nvs_write_float(const char *namespace, const char *key, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    esp_err_t err = esp32_nvs_store(namespace, key, NVS_TYPE_U32, &bits, 0);
+    return write_reported(err, namespace, key, NVS_CHANGE_FLOAT, &value, 0);
+}
+
+esp_err_t nvs_write_double(const char *namespace, const char *key, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    esp_err_t err = esp32_nvs_store(namespace, key, NVS_TYPE_U64, &bits, 0);
+    return write_reported(err, namespace, key, NVS_CHANGE_DOUBLE, &value, 0);
+}
+
+esp_err_t nvs_write_blob(const char *namespace, const char *key, const void *value, size_t length)
+{
+    return esp32_nvs_write(namespace, key, NVS_TYPE_BLOB, value, length);
+}
+
+// Read a value from the value cache or from NVS, the namespace lock has to be taken
+static esp_err_t esp32_nvs_read_stored(const char *namespace, const char *key, nvs_type_t type_value,
+                                       void *value, size_t *length)
+{
+    esp_err_t err;
+    if (value_cache_get(namespace, key, type_value, value, length, &err)) {
+        return err;
+    }
+
+    nvs_handle_t nvs_handle;
+    err = esp32_nvs_open(namespace, NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = esp32_nvs_get(nvs_handle, key, type_value, value, length);
+    if (err == ESP_OK && value != NULL) {
+        const void *read_value = (type_value == NVS_TYPE_STR && length == NULL) ? *(char**)value : value;
+        stored_value_put(namespace, key, type_value, read_value, (length != NULL) ? *length : 0);
+    }
+    if (err == ESP_ERR_NVS_INVALID_HANDLE) {
+        handle_cache_invalidate(namespace);
+    }
+    return err;
+}
+
+// The value and length arguments have the same meaning as for esp32_nvs_get()
+static esp_err_t esp32_nvs_read(const char *namespace, const char *key, nvs_type_t type_value,
+                                void *value, size_t *length)
+{
+    if (namespace == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to read value: namespace is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (key == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to read value: key is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (value == NULL && !(type_value == NVS_TYPE_STR && length != NULL)) {
+        ESP_LOGE(TAG, "%s(): Failed to read NULL value!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // A queued value is newer than the stored one
+    esp_err_t err;
+    if (!write_queue_get(namespace, key, type_value, value, length, &err)) {
+        nvs_lock_namespace(namespace);
+        NVS_METRIC_START(read_start);
+        err = esp32_nvs_read_stored(namespace, key, type_value, value, length);
+        NVS_METRIC(metrics_add_read(err, read_start));
+        nvs_unlock_namespace(namespace);
+    }
+
+    switch (err) {
+        case ESP_OK:
+            switch (type_value) {
+                case NVS_TYPE_STR: {
+                    const char *string = (length == NULL) ? *(char**)value : (const char*)value;
+                    if (string != NULL) {
+                        NVS_LOGI(READ, "Successfully read string from NVS %s.%s: %.*s", namespace, key,
+                                 NVS_LOG_STRING_MAX_LENGTH, string);
+                    }
+                    break;
+                }
+                case NVS_TYPE_BLOB:
+                    NVS_LOGI(READ, "Successfully read blob from NVS %s.%s", namespace, key);
+                    break;
+                default: {
+                    char string_value[VALUE_STRING_SIZE];
+                    NVS_LOGI(READ, "Successfully read value from NVS %s.%s: %s", namespace, key,
+                             value_to_string(type_value, value, string_value, sizeof(string_value)));
+                    break;
+                }
+            }
+            break;
+        case ESP_ERR_NVS_NOT_FOUND:
+            NVS_LOGW(READ, "Value %s.%s is not initialized yet", namespace, key);
+            break;
+        case ESP_ERR_NVS_INVALID_LENGTH:
+            NVS_LOGW(READ, "Buffer for %s.%s is too small, %u bytes required", namespace, key, (unsigned)*length);
+            break;
+        default:
+            ESP_LOGE(TAG, "Failed to read from NVS %s.%s: %d (%s)", namespace, key, err, esp_err_to_name(err));
+            break;
+    }
+    return err;
+}
+
+esp_err_t nvs_read_int8(const char *namespace, const char *key, void *out_value)
+{
+    return esp32_nvs_read(namespace, key, NVS_TYPE_I8, out_value, NULL);
+}
+
+esp_err_t nvs_read_uint8(const char *namespace, const char *key, void *out_value)
+{
+    return esp32_nvs_read(namespace, key, NVS_TYPE_U8, out_value, NULL);
+}
+
+esp_err_t nvs_read_int16(const char *namespace, const char *key, void *out_value)
+{
+    return esp32_nvs_read(namespace, key, NVS_TYPE_I16, out_value, NULL);
+}
+
+esp_err_t nvs_read_uint16(const char *namespace, const char *key, void *out_value)
+{
+    return esp32_nvs_read(namespace, key, NVS_TYPE_U16, out_value, NULL);
+}
+
+esp_err_t nvs_read_int32(const char *namespace, const char *key, void *out_value)
+{
+    return esp32_nvs_read(namespace, key, NVS_TYPE_I32, out_value, NULL);
+}
+
+esp_err_t nvs_read_uint32(const char *namespace, const char *key, void *out_value)
+{
+    return esp32_nvs_read(namespace, key, NVS_TYPE_U32, out_value, NULL);
+}
+
+esp_err_t nvs_read_int64(const char *namespace, const char *key, void *out_value)
+{
+    return esp32_nvs_read(namespace, key, NVS_TYPE_I64, out_value, NULL);
+}
+
+esp_err_t nvs_read_uint64(const char *namespace, const char *key, void *out_value)
+{
+    return esp32_nvs_read(namespace, key, NVS_TYPE_U64, out_value, NULL);
+}
+
+esp_err_t nvs_read_string(const char *namespace, const char *key, void *out_value)
+{
+    return esp32_nvs_read(namespace, key, NVS_TYPE_STR, out_value, NULL);
+}
+
+esp_err_t nvs_read_string_into(const char *namespace, const char *key, char *buffer, size_t *length)
+{
+    if (length == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to read string: length is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    return esp32_nvs_read(namespace, key, NVS_TYPE_STR, buffer, length);
+}
+
+// Handle of a bound key, opened again only if the handle cache closed a handle since the last call or a write needs
+// a read-write one. Once written, the namespace exists and the key stays read-write. The namespace lock has to be
+// taken.
+static esp_err_t key_ref_handle(nvs_key_ref_t *ref, nvs_open_mode_t open_mode, nvs_handle_t *nvs_handle)
+{
+    esp_err_t err = ESP_OK;
+    if (ref->open_mode == NVS_READWRITE) {
+        open_mode = NVS_READWRITE;
+    }
+    state_lock();
+    bool current = ref->generation == handle_cache_generation;
+    state_unlock();
+
+    // Only the holder of the namespace lock closes the handle, so the generation read after the open is its own
+    if (!current || open_mode != ref->open_mode) {
+        err = esp32_nvs_open(ref->namespace_name, open_mode, &ref->handle);
+        if (err == ESP_OK) {
+            ref->open_mode = open_mode;
+            state_lock();
+            ref->generation = handle_cache_generation;
+            state_unlock();
+        }
+    }
+    *nvs_handle = ref->handle;
+    return err;
+}
+
+esp_err_t nvs_key_bind(const char *namespace, const char *key, nvs_type_t type_value, nvs_key_ref_t *out_ref)
+{
+    if (namespace == NULL || key == NULL || out_ref == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to bind key: namespace, key or out_ref is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strlen(namespace) >= sizeof(out_ref->namespace_name) || strlen(key) >= sizeof(out_ref->key)) {
+        ESP_LOGE(TAG, "%s(): Failed to bind key %s: namespace or key is too long!", __func__, key);
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    if (type_value == NVS_TYPE_ANY) {
+        ESP_LOGE(TAG, "%s(): Failed to bind key %s: NVS_TYPE_ANY is not a value type!", __func__, key);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(out_ref, 0, sizeof(*out_ref));
+    strcpy(out_ref->namespace_name, namespace);
+    strcpy(out_ref->key, key);
+    out_ref->type = type_value;
+    out_ref->open_mode = NVS_READONLY;
+    out_ref->shard = namespace_shard(namespace);
+
+    // A namespace which doesn't exist yet is opened by the first write
+    nvs_lock_shard(out_ref->shard);
+    esp_err_t err = key_ref_handle(out_ref, NVS_READONLY, &out_ref->handle);
+    nvs_unlock_shard(out_ref->shard);
+    return (err == ESP_ERR_NVS_NOT_FOUND) ? ESP_OK : err;
+}
+
+esp_err_t nvs_key_read(nvs_key_ref_t *ref, void *out_value, size_t *length)
+{
+    if (ref == NULL || out_value == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err;
+    if (write_queue_get(ref->namespace_name, ref->key, ref->type, out_value, length, &err)) {
+        return err;
+    }
+    nvs_lock_shard(ref->shard);
+    NVS_METRIC_START(read_start);
+    if (!value_cache_get(ref->namespace_name, ref->key, ref->type, out_value, length, &err)) {
+        nvs_handle_t nvs_handle;
+        err = key_ref_handle(ref, NVS_READONLY, &nvs_handle);
+        if (err == ESP_OK) {
+            err = esp32_nvs_get(nvs_handle, ref->key, ref->type, out_value, length);
+        }
+        if (err == ESP_OK) {
+            const void *read_value = (ref->type == NVS_TYPE_STR && length == NULL) ? *(char**)out_value : out_value;
+            stored_value_put(ref->namespace_name, ref->key, ref->type, read_value, (length != NULL) ? *length : 0);
+        } else if (err == ESP_ERR_NVS_INVALID_HANDLE) {
+            handle_cache_invalidate(ref->namespace_name);
+        }
+    }
+    NVS_METRIC(metrics_add_read(err, read_start));
+    nvs_unlock_shard(ref->shard);
+
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "Failed to read from NVS %s.%s: %d (%s)", ref->namespace_name, ref->key, err,
+                 esp_err_to_name(err));
+    }
+    return err;
+}
+
+esp_err_t nvs_key_write(nvs_key_ref_t *ref, const void *value, size_t length)
+{
+    if (ref == NULL || value == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err;
+    if (!write_queue_push(ref->namespace_name, ref->key, ref->type, value, length, &err)) {
+        nvs_lock_shard(ref->shard);
+        write_queue_drop(ref->namespace_name, ref->key);
+        nvs_handle_t nvs_handle;
+        err = key_ref_handle(ref, NVS_READWRITE, &nvs_handle);
+        if (err == ESP_OK) {
+            err = esp32_nvs_write_handle(nvs_handle, ref->namespace_name, ref->key, ref->type, value, length,
+                                         skip_unchanged_writes);
+        }
+        nvs_unlock_shard(ref->shard);
+    }
+    return write_reported(err, ref->namespace_name, ref->key, ref->type, value, length);
+}
+
+static esp_err_t find_key(nvs_handle_t nvs_handle, const char *namespace, const char *key, nvs_type_t *type_value)
+{
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+    (void)namespace;
+    return nvs_find_key(nvs_handle, key, type_value);
+#else
+    // nvs_find_key() came with ESP-IDF 5.1, before that the entry iterator finds the key
+    (void)nvs_handle;
+    nvs_iterator_t iterator = NULL;
+    esp_err_t err = nvs_entry_find(NVS_DEFAULT_PART_NAME, namespace, NVS_TYPE_ANY, &iterator);
+    while (err == ESP_OK) {
+        nvs_entry_info_t info;
+        err = nvs_entry_info(iterator, &info);
+        if (err == ESP_OK && strcmp(info.key, key) == 0) {
+            *type_value = info.type;
+            break;
+        }
+        if (err == ESP_OK) {
+            err = nvs_entry_next(&iterator);
+        }
+    }
+    nvs_release_iterator(iterator);
+    return err;
+#endif
+}
+
+static esp_err_t esp32_nvs_key_exists(const char *namespace, const char *key, nvs_type_t *type_value,
+                                      size_t *length)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err = handle_cache_open(namespace, NVS_READONLY, &nvs_handle);
+    if (err == ESP_OK) {
+        err = find_key(nvs_handle, namespace, key, type_value);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // With a NULL buffer nvs_get_str()/nvs_get_blob() only look up the length
+    switch (*type_value) {
+        case NVS_TYPE_STR:
+            return nvs_get_str(nvs_handle, key, NULL, length);
+        case NVS_TYPE_BLOB:
+            return nvs_get_blob(nvs_handle, key, NULL, length);
+        default:
+            *length = scalar_size(*type_value);
+            return ESP_OK;
+    }
+}
+
+esp_err_t nvs_key_exists(const char *namespace, const char *key, nvs_type_t *out_type, size_t *out_length)
+{
+    if (namespace == NULL || key == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    nvs_type_t type_value = NVS_TYPE_ANY;
+    size_t length = 0;
+    esp_err_t err = ESP_OK;
+    if (!write_queue_stat(namespace, key, &type_value, &length)) {
+        nvs_lock_namespace(namespace);
+        err = esp32_nvs_key_exists(namespace, key, &type_value, &length);
+        nvs_unlock_namespace(namespace);
+    }
+    if (err == ESP_OK) {
+        if (out_type != NULL) {
+            *out_type = type_value;
+        }
+        if (out_length != NULL) {
+            *out_length = length;
+        }
+    }
+    return err;
+}
+
+// Older versions stored float and double as "%f" strings, which never were longer than this
+#define MAX_LEGACY_FLOATING_STRING_LENGTH 64
+
+static esp_err_t read_legacy_floating(nvs_handle_t nvs_handle, const char *key, void *out_value, bool is_double)
+{
+    char string[MAX_LEGACY_FLOATING_STRING_LENGTH];
+    size_t length = sizeof(string);
+    esp_err_t err = get_string_into(nvs_handle, key, string, &length);
+    if (err == ESP_ERR_NVS_INVALID_LENGTH) {
+        return ESP_ERR_NVS_TYPE_MISMATCH;  // Too long to be a float or double written by an older version
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    char *end = NULL;
+    if (is_double) {
+        *(double*)out_value = strtod(string, &end);
+    } else {
+        *(float*)out_value = strtof(string, &end);
+    }
+    return (end == string) ? ESP_ERR_NVS_TYPE_MISMATCH : ESP_OK;
+}
+
+static esp_err_t get_floating(nvs_handle_t nvs_handle, const char *key, void *out_value, bool is_double)
+{
+    esp_err_t err;
+    if (is_double) {
+        uint64_t bits;
+        err = nvs_get_u64(nvs_handle, key, &bits);
+        if (err == ESP_OK) {
+            memcpy(out_value, &bits, sizeof(bits));
+        }
+    } else {
+        uint32_t bits;
+        err = nvs_get_u32(nvs_handle, key, &bits);
+        if (err == ESP_OK) {
+            memcpy(out_value, &bits, sizeof(bits));
+        }
+    }
+    return err;
+}
+
+// Read a floating value from the value cache or from NVS, the namespace lock has to be taken
+static esp_err_t read_stored_floating(const char *namespace, const char *key, void *out_value, bool is_double)
+{
+    nvs_type_t type_value = is_double ? NVS_TYPE_U64 : NVS_TYPE_U32;
+    esp_err_t err;
+    if (value_cache_get(namespace, key, type_value, out_value, NULL, &err)) {
+        return err;
+    }
+
+    nvs_handle_t nvs_handle;
+    err = esp32_nvs_open(namespace, NVS_READONLY, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = get_floating(nvs_handle, key, out_value, is_double);
+    if (err == ESP_OK) {
+        value_cache_put(namespace, key, type_value, out_value, 0);
+    } else if (err == ESP_ERR_NVS_NOT_FOUND) {
+        err = read_legacy_floating(nvs_handle, key, out_value, is_double);
+    }
+    if (err == ESP_ERR_NVS_INVALID_HANDLE) {
+        handle_cache_invalidate(namespace);
+    }
+    return err;
+}
+
+static esp_err_t esp32_nvs_read_floating(const char *namespace, const char *key, void *out_value, bool is_double)
+{
+    if (namespace == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to read value: namespace is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (key == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to read value: key is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (out_value == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to read NULL value!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Floating values are queued as their bit pattern
+    esp_err_t err;
+    if (!write_queue_get(namespace, key, is_double ? NVS_TYPE_U64 : NVS_TYPE_U32, out_value, NULL, &err)) {
+        nvs_lock_namespace(namespace);
+        NVS_METRIC_START(read_start);
+        err = read_stored_floating(namespace, key, out_value, is_double);
+        NVS_METRIC(metrics_add_read(err, read_start));
+        nvs_unlock_namespace(namespace);
+    }
+
+    switch (err) {
+        case ESP_OK:
+            NVS_LOGI(READ, "Successfully read value from NVS %s.%s: %f", namespace, key,
+                     is_double ? *(double*)out_value : *(float*)out_value);
+            break;
+        case ESP_ERR_NVS_NOT_FOUND:
+            NVS_LOGW(READ, "Value %s.%s is not initialized yet", namespace, key);
+            break;
+        default:
+            ESP_LOGE(TAG, "Failed to read from NVS %s.%s: %d (%s)", namespace, key, err, esp_err_to_name(err));
+            break;
+    }
+    return err;
+}
+
+esp_err_t nvs_read_float(const char *namespace, const char *key, void *out_value)
+{
+    return esp32_nvs_read_floating(namespace, key, out_value, false);
+}
+
+esp_err_t nvs_read_double(const char *namespace, const char *key, void *out_value)
+{
+    return esp32_nvs_read_floating(namespace, key, out_value, true);
+}
+
+static esp_err_t esp32_nvs_migrate_floating(const char *namespace, const char *key, bool is_double)
+{
+    if (namespace == NULL || key == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to migrate value: namespace or key is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    nvs_handle_t nvs_handle;
+    esp_err_t err = esp32_nvs_open(namespace, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    union {
+        float f;
+        double d;
+        uint32_t u32;
+        uint64_t u64;
+    } value;
+    err = get_floating(nvs_handle, key, &value, is_double);
+    if (err == ESP_OK) {
+        return ESP_OK;  // Already stored as a bit pattern
+    }
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        err = read_legacy_floating(nvs_handle, key, &value, is_double);
+    }
+
+    // The string has to go first, NVS does not keep two values of different types under the same key
+    if (err == ESP_OK) {
+        err = nvs_erase_key(nvs_handle, key);
+    }
+    if (err == ESP_OK) {
+        err = is_double ? nvs_set_u64(nvs_handle, key, value.u64) : nvs_set_u32(nvs_handle, key, value.u32);
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+
+    stored_value_invalidate(namespace, key);
+    if (err == ESP_OK) {
+        NVS_LOGI(MAINT, "Successfully migrate NVS %s.%s to binary format", namespace, key);
+    } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "Failed to migrate NVS %s.%s: %d (%s)!", namespace, key, err, esp_err_to_name(err));
+    }
+
+    if (err == ESP_ERR_NVS_INVALID_HANDLE) {
+        handle_cache_invalidate(namespace);
+    }
+    return err;
+}
+
+esp_err_t nvs_migrate_float(const char *namespace, const char *key)
+{
+    nvs_lock_namespace(namespace);
+    esp_err_t err = esp32_nvs_migrate_floating(namespace, key, false);
+    nvs_unlock_namespace(namespace);
+    return err;
+}
+
+esp_err_t nvs_migrate_double(const char *namespace, const char *key)
+{
+    nvs_lock_namespace(namespace);
+    esp_err_t err = esp32_nvs_migrate_floating(namespace, key, true);
+    nvs_unlock_namespace(namespace);
+    return err;
+}
+
+/* Compressed blobs */
+
+#ifndef NVS_COMPRESS_HASH_BITS
+#define NVS_COMPRESS_HASH_BITS 9  // The compressor's match table has 2^bits entries of 4 bytes, allocated per write
+#endif
+#ifndef NVS_COMPRESS_MIN_SIZE
+#define NVS_COMPRESS_MIN_SIZE 32  // Smaller blobs are always stored raw
+#endif
+
+#define NVS_COMPRESS_MIN_MATCH 4
+#define NVS_COMPRESS_MAX_OFFSET UINT16_MAX
+#define NVS_COMPRESS_NO_POSITION UINT32_MAX
+
+static const uint8_t COMPRESSED_MAGIC[3] = { 'N', 'V', 'Z' };
+
+typedef enum {
+    NVS_CODEC_LZ = 1,  // LZ4-style sequences: token, literals, 16-bit offset, match length
+} nvs_codec_t;
+
+typedef struct {
+    uint8_t magic[3];
+    uint8_t codec;
+    uint32_t length;  // Length of the original blob
+} nvs_compressed_header_t;
+
+static uint32_t lz_read32(const uint8_t *source)
+{
+    uint32_t value;
+    memcpy(&value, source, sizeof(value));
+    return value;
+}
+
+static uint32_t lz_hash(uint32_t value)
+{
+    return (value * 2654435761U) >> (32 - NVS_COMPRESS_HASH_BITS);
+}
+
+// Length nibble of a token and the extra bytes following it, false if it doesn't fit into the output
+static bool lz_put_length(uint8_t **out, const uint8_t *end, size_t length)
+{
+    for (length -= 15; length >= 255; length -= 255) {
+        if (*out >= end) {
+            return false;
+        }
+        *(*out)++ = 255;
+    }
+    if (*out >= end) {
+        return false;
+    }
+    *(*out)++ = (uint8_t)length;
+    return true;
+}
+
+static bool lz_put_sequence(uint8_t **out, const uint8_t *end, const uint8_t *literals, size_t literal_length,
+                            size_t offset, size_t match_length)
+{
+    if (*out >= end) {
+        return false;
+    }
+    uint8_t *token = (*out)++;
+    *token = (uint8_t)(((literal_length < 15) ? literal_length : 15) << 4);
+    if (literal_length >= 15 && !lz_put_length(out, end, literal_length)) {
+        return false;
+    }
+    if ((size_t)(end - *out) < literal_length) {
+        return false;
+    }
+    memcpy(*out, literals, literal_length);
+    *out += literal_length;
+    if (match_length == 0) {
+        return true;  // The last sequence has literals only
+    }
+
+    if (end - *out < 2) {
+        return false;
+    }
+    *(*out)++ = (uint8_t)offset;
+    *(*out)++ = (uint8_t)(offset >> 8);
+    match_length -= NVS_COMPRESS_MIN_MATCH;
+    *token |= (uint8_t)((match_length < 15) ? match_length : 15);
+    return match_length < 15 || lz_put_length(out, end, match_length);
+}
+
+// Return the compressed length, 0 if it would not be smaller than capacity or can't be decompressed in place
+
+static size_t lz_compress(const uint8_t *source, size_t length, uint8_t *destination, size_t capacity,
+                          uint32_t *table)
+{
+    for (size_t i = 0; i < (1U << NVS_COMPRESS_HASH_BITS); ++i) {
+        table[i] = NVS_COMPRESS_NO_POSITION;
+    }
+    uint8_t *out = destination;
+    const uint8_t *end = destination + capacity;
+    size_t anchor = 0;
+    size_t position = 0;
+    size_t ahead = 0;  // Furthest the output got ahead of the stream after a match
+    while (position + NVS_COMPRESS_MIN_MATCH <= length) {
+        uint32_t sequence = lz_read32(source + position);
+        uint32_t hash = lz_hash(sequence);
+        uint32_t candidate = table[hash];
+        table[hash] = (uint32_t)position;
+        if (candidate == NVS_COMPRESS_NO_POSITION || position - candidate > NVS_COMPRESS_MAX_OFFSET ||
+            lz_read32(source + candidate) != sequence) {
+            ++position;
+            continue;
+        }
+
+        size_t match_length = NVS_COMPRESS_MIN_MATCH;
+        while (position + match_length < length &&
+               source[candidate + match_length] == source[position + match_length]) {
+            ++match_length;
+        }
+        if (!lz_put_sequence(&out, end, source + anchor, position - anchor, position - candidate, match_length)) {
+            return 0;
+        }
+        position += match_length;
+        anchor = position;
+        size_t consumed = (size_t)(out - destination);
+        ahead = (position > consumed && position - consumed > ahead) ? position - consumed : ahead;
+    }
+    size_t tail_start = (size_t)(out - destination);
+    if (!lz_put_sequence(&out, end, source + anchor, length - anchor, 0, 0)) {
+        return 0;
+    }
+    // The same condition lz_decompress() checks: no match may get the output further ahead than the last one
+    return (anchor >= tail_start && ahead <= anchor - tail_start) ? (size_t)(out - destination) : 0;
+}
+
+// Length of a token nibble plus its extra bytes, false if the input ends early
+static bool lz_get_length(const uint8_t **in, const uint8_t *end, size_t *length)
+{
+    if (*length != 15) {
+        return true;
+    }
+    uint8_t byte;
+    do {
+        if (*in >= end) {
+            return false;
+        }
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+/*
+ * Decompress exactly length bytes, false if the input is not a valid stream of that length or can't be decompressed
+ * in place (see blob_decompress()). Without a destination the stream is only checked. The length of the final
+ * literals and the offset of the sequence holding them in the stream are stored in tail and tail_start.
+ */
+static bool lz_decompress(const uint8_t *source, size_t source_length, uint8_t *destination, size_t length,
+                          size_t *tail, size_t *tail_start)
+{
+    const uint8_t *in = source;
+    const uint8_t *in_end = source + source_length;
+    size_t out = 0;
+    size_t ahead = 0;  // Furthest the output got ahead of the stream after a match
+    *tail = 0;
+    *tail_start = source_length;
+    while (in < in_end) {
+        const uint8_t *sequence = in;
+        uint8_t token = *in++;
+        size_t literal_length = token >> 4;
+        if (!lz_get_length(&in, in_end, &literal_length) || (size_t)(in_end - in) < literal_length ||
+            length - out < literal_length) {
+            return false;
+        }
+        if (destination != NULL) {
+            memmove(destination + out, in, literal_length);
+        }
+        in += literal_length;
+        out += literal_length;
+        if (in == in_end) {
+            *tail = literal_length;
+            *tail_start = (size_t)(sequence - source);
+            break;
+        }
+
+        if (in_end - in < 2) {
+            return false;
+        }
+        size_t offset = in[0] | ((size_t)in[1] << 8);
+        in += 2;
+        size_t match_length = token & 0x0F;
+        if (!lz_get_length(&in, in_end, &match_length)) {
+            return false;
+        }
+        match_length += NVS_COMPRESS_MIN_MATCH;
+        if (offset == 0 || offset > out || length - out < match_length) {
+            return false;
+        }
+        if (destination != NULL) {
+            // Byte by byte, the match may overlap the bytes it produces
+            for (size_t i = 0; i < match_length; ++i) {
+                destination[out + i] = destination[out + i - offset];
+            }
+        }
+        out += match_length;
+        size_t consumed = (size_t)(in - source);
+        ahead = (out > consumed && out - consumed > ahead) ? out - consumed : ahead;
+    }
+    return out == length && *tail + *tail_start <= length && ahead <= length - *tail - *tail_start;
+}
+
+esp_err_t nvs_write_blob_compressed(const char *namespace, const char *key, const void *value, size_t length)
+{
+    if (value == NULL || length < NVS_COMPRESS_MIN_SIZE || length > UINT32_MAX) {
+        return esp32_nvs_write(namespace, key, NVS_TYPE_BLOB, value, length);
+    }
+
+    // The output buffer is one byte shorter than the blob, so a stored compressed blob always saves space
+    size_t capacity = length - 1;
+    uint8_t *stored = malloc(capacity);
+    uint32_t *table = malloc(sizeof(uint32_t) << NVS_COMPRESS_HASH_BITS);
+    if (stored == NULL || table == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+        free(stored);
+        free(table);
+        return ESP_ERR_NO_MEM;
+    }
+
+    nvs_compressed_header_t header = { .codec = NVS_CODEC_LZ, .length = (uint32_t)length };
+    memcpy(header.magic, COMPRESSED_MAGIC, sizeof(header.magic));
+    size_t compressed_length = 0;
+    if (capacity > sizeof(header)) {
+        compressed_length = lz_compress(value, length, stored + sizeof(header), capacity - sizeof(header), table);
+    }
+    free(table);
+
+    // Subscribers get the blob as passed, not the stored stream
+    esp_err_t err;
+    if (compressed_length > 0) {
+        memcpy(stored, &header, sizeof(header));
+        err = esp32_nvs_store(namespace, key, NVS_TYPE_BLOB, stored, sizeof(header) + compressed_length);
+        if (err == ESP_OK) {
+            NVS_LOGD(WRITE, "Blob %s.%s compressed from %u to %u bytes", namespace, key, (unsigned)length,
+                     (unsigned)(sizeof(header) + compressed_length));
+        }
+    } else {
+        err = esp32_nvs_store(namespace, key, NVS_TYPE_BLOB, value, length);
+    }
+    free(stored);
+    return write_reported(err, namespace, key, NVS_TYPE_BLOB, value, length);
+}
+
+// Original length of a compressed blob, 0 if the blob doesn't start with a valid header
+static size_t compressed_original_length(const uint8_t *value, size_t stored_length)
+{
+    nvs_compressed_header_t header;
+    if (stored_length <= sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, value, sizeof(header));
+    if (memcmp(header.magic, COMPRESSED_MAGIC, sizeof(header.magic)) != 0 || header.codec != NVS_CODEC_LZ ||
+        header.length <= stored_length) {
+        return 0;
+    }
+    return header.length;
+}
+
+/*
+ * Decompress a blob read into the caller's buffer in place, length is updated to the original length. A blob which
+ * doesn't carry a valid header and stream is a raw one and stays as it is.
+ */
+static esp_err_t blob_decompress(uint8_t *value, size_t *length, size_t capacity)
+{
+    size_t original_length = compressed_original_length(value, *length);
+    if (original_length == 0) {
+        return ESP_OK;
+    }
+    if (original_length > capacity) {
+        ESP_LOGE(TAG, "%s(): Blob of %u bytes doesn't fit into the buffer!", __func__, (unsigned)original_length);
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    // The stream is checked where it was read, a blob which doesn't pass is a raw one
+    const uint8_t *stream = value + sizeof(nvs_compressed_header_t);
+    size_t compressed_length = *length - sizeof(nvs_compressed_header_t);
+    size_t tail;
+    size_t tail_start;
+    if (!lz_decompress(stream, compressed_length, NULL, original_length, &tail, &tail_start)) {
+        return ESP_OK;
+    }
+
+    // The final literals are moved to their place at the end of the buffer and the sequences before them right in
+    // front of them. Decompressed into the buffer, the output never overtakes the part of them still to be read.
+    memmove(value + original_length - tail, stream + compressed_length - tail, tail);
+    uint8_t *sequences = value + original_length - tail - tail_start;
+    memmove(sequences, stream, tail_start);
+    lz_decompress(sequences, tail_start, value, original_length - tail, &tail, &tail_start);
+    *length = original_length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_read_blob(const char *namespace, const char *key, void *out_value, size_t length)
+{
+    size_t capacity = length;
+    esp_err_t err = esp32_nvs_read(namespace, key, NVS_TYPE_BLOB, out_value, &length);
+    if (err == ESP_OK) {
+        err = blob_decompress(out_value, &length, capacity);
+    }
+    return err;
+}
+
+// "<key>#<slot>" for any uint8_t slot; the slots actually used keep the key within NVS_KEY_NAME_MAX_SIZE
+#define COUNTER_SLOT_KEY_SIZE (NVS_KEY_NAME_MAX_SIZE + 2)
+
+static void counter_slot_key(const nvs_counter_t *counter, uint8_t slot, char *slot_key)
+{
+    snprintf(slot_key, COUNTER_SLOT_KEY_SIZE, "%s#%u", counter->key, (unsigned)slot);
+}
+
+// Recover a counter from its slots, the namespace lock of the counter has to be taken
+static esp_err_t counter_load(nvs_counter_t *counter)
+{
+    nvs_handle_t nvs_handle;
+    esp_err_t err = esp32_nvs_open(counter->namespace, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // The slot with the largest value was written last; a slot lost to a power failure only costs one interval
+    counter->persisted = 0;
+    counter->next_slot = 0;
+    for (uint8_t slot = 0; slot < NVS_COUNTER_SLOTS; ++slot) {
+        char slot_key[COUNTER_SLOT_KEY_SIZE];
+        counter_slot_key(counter, slot, slot_key);
+        uint64_t value = 0;
+        if (!write_queue_get(counter->namespace, slot_key, NVS_TYPE_U64, &value, NULL, &err)) {
+            err = esp32_nvs_get(nvs_handle, slot_key, NVS_TYPE_U64, &value, NULL);
+        }
+        if (err == ESP_OK && value >= counter->persisted) {
+            counter->persisted = value;
+            counter->next_slot = (slot + 1) % NVS_COUNTER_SLOTS;
+        } else if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGE(TAG, "Failed to read from NVS %s.%s: %d (%s)", counter->namespace, slot_key, err,
+                     esp_err_to_name(err));
+            return err;
+        }
+    }
+    counter->value = counter->persisted;
+    counter->persisted_at = xTaskGetTickCount();
+    return ESP_OK;
+}
+
+/*
+ * Find a counter, loading it on first use. The namespace lock of the counter has to be taken. A new counter is loaded
+ * without the state lock into an entry reserved for it, which only the holder of the namespace lock can look up.
+ */
+static esp_err_t counter_find(const char *namespace, const char *key, nvs_counter_t **out_counter)
+{
+    if (namespace == NULL || key == NULL) {
+        ESP_LOGE(TAG, "%s(): Namespace or key is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strlen(namespace) >= NVS_KEY_NAME_MAX_SIZE || strlen(key) >= sizeof(((nvs_counter_t*)0)->key)) {
+        ESP_LOGE(TAG, "%s(): Counter %s.%s has a too long name!", __func__, namespace, key);
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+
+    nvs_counter_t *free_counter = NULL;
+    state_lock();
+    for (size_t i = 0; i < NVS_COUNTER_MAX_COUNT; ++i) {
+        nvs_counter_t *counter = &counter_table.counters[i];
+        if (counter->in_use && strcmp(counter->key, key) == 0 && strcmp(counter->namespace, namespace) == 0) {
+            *out_counter = counter;
+            state_unlock();
+            return ESP_OK;
+        }
+        if (!counter->in_use && free_counter == NULL) {
+            free_counter = counter;
+        }
+    }
+    if (free_counter != NULL) {
+        // Reserved with nothing pending, so nvs_counter_flush() skips it while it is loaded
+        memset(free_counter, 0, sizeof(*free_counter));
+        free_counter->in_use = true;
+        strcpy(free_counter->namespace, namespace);
+        strcpy(free_counter->key, key);
+    }
+    state_unlock();
+    if (free_counter == NULL) {
+        ESP_LOGE(TAG, "%s(): No free slot for counter %s.%s!", __func__, namespace, key);
+        return ESP_ERR_NO_MEM;
+    }
+
+    nvs_counter_t loaded = { .in_use = true };
+    strcpy(loaded.namespace, namespace);
+    strcpy(loaded.key, key);
+    esp_err_t err = counter_load(&loaded);
+    state_lock();
+    if (err == ESP_OK) {
+        *free_counter = loaded;
+        *out_counter = free_counter;
+    } else {
+        free_counter->in_use = false;
+    }
+    state_unlock();
+    return err;
+}
+
+// The state lock has to be taken
+static bool counter_due(const nvs_counter_t *counter)
+{
+    uint64_t pending = counter->value - counter->persisted;
+    if (pending == 0) {
+        return false;
+    }
+    if (counter_table.threshold > 0 && pending >= counter_table.threshold) {
+        return true;
+    }
+    return counter_table.interval_ms > 0 &&
+           xTaskGetTickCount() - counter->persisted_at >= pdMS_TO_TICKS(counter_table.interval_ms);
+}
+
+/*
+ * Write the counter to its next slot. Called with the namespace lock of the counter taken, which is released during
+ * the write: with the write queue running, the write may have to wait for the worker, which needs the namespace lock.
+ */
+static esp_err_t counter_persist(nvs_counter_t *counter)
+{
+    char namespace[NVS_KEY_NAME_MAX_SIZE];
+    char slot_key[COUNTER_SLOT_KEY_SIZE];
+    state_lock();
+    strcpy(namespace, counter->namespace);
+    counter_slot_key(counter, counter->next_slot, slot_key);
+    uint64_t value = counter->value;
+    uint64_t previous = counter->persisted;
+    uint8_t slot = counter->next_slot;
+
+    counter->persisted = value;
+    counter->next_slot = (slot + 1) % NVS_COUNTER_SLOTS;
+    counter->persisted_at = xTaskGetTickCount();
+    state_unlock();
+
+    nvs_unlock_namespace(namespace);
+    esp_err_t err = esp32_nvs_store(namespace, slot_key, NVS_TYPE_U64, &value, 0);
+    nvs_lock_namespace(namespace);
+    if (err == NVS_WRITE_UNCHANGED) {
+        err = ESP_OK;
+    }
+
+    state_lock();
+    if (err != ESP_OK && counter->in_use && counter->next_slot == (slot + 1) % NVS_COUNTER_SLOTS) {
+        counter->persisted = previous;  // Try again with the next add or flush
+        counter->next_slot = slot;
+    }
+    state_unlock();
+    return err;
+}
+
+esp_err_t nvs_counter_configure(uint32_t interval_ms, uint64_t threshold)
+{
+    state_lock();
+    counter_table.interval_ms = interval_ms;
+    counter_table.threshold = threshold;
+    state_unlock();
+    return ESP_OK;
+}
+
+esp_err_t nvs_counter_add(const char *namespace, const char *key, uint64_t delta)
+{
+    nvs_counter_t *counter;
+    nvs_lock_namespace(namespace);
+    esp_err_t err = counter_find(namespace, key, &counter);
+    if (err == ESP_OK) {
+        state_lock();
+        counter->value += delta;
+        bool due = counter_due(counter);
+        state_unlock();
+        if (due) {
+            err = counter_persist(counter);
+        }
+    }
+    nvs_unlock_namespace(namespace);
+    return err;
+}
+
+esp_err_t nvs_counter_get(const char *namespace, const char *key, uint64_t *out_value)
+{
+    if (out_value == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to read NULL value!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    nvs_counter_t *counter;
+    nvs_lock_namespace(namespace);
+    esp_err_t err = counter_find(namespace, key, &counter);
+    if (err == ESP_OK) {
+        state_lock();
+        *out_value = counter->value;
+        state_unlock();
+    }
+    nvs_unlock_namespace(namespace);
+    return err;
+}
+
+// Whether the entry holds a counter of the namespace with an unwritten change, the state lock has to be taken
+static bool counter_pending(const nvs_counter_t *counter, const char *namespace)
+{
+    return counter->in_use && strcmp(counter->namespace, namespace) == 0 && counter->value != counter->persisted;
+}
+
+esp_err_t nvs_counter_flush(void)
+{
+    esp_err_t result = ESP_OK;
+    for (size_t i = 0; i < NVS_COUNTER_MAX_COUNT; ++i) {
+        nvs_counter_t *counter = &counter_table.counters[i];
+        char namespace[NVS_KEY_NAME_MAX_SIZE];
+        state_lock();
+        strcpy(namespace, counter->namespace);
+        bool pending = counter_pending(counter, namespace);
+        state_unlock();
+        if (!pending) {
+            continue;
+        }
+
+        // Checked again under the namespace lock, the entry may have been reused meanwhile
+        nvs_lock_namespace(namespace);
+        state_lock();
+        pending = counter_pending(counter, namespace);
+        state_unlock();
+        if (pending) {
+            esp_err_t err = counter_persist(counter);
+            if (result == ESP_OK) {
+                result = err;
+            }
+        }
+        nvs_unlock_namespace(namespace);
+    }
+    return result;
+}
+
+static esp_err_t esp32_nvs_erase_value(const char *namespace, const char *key)
+{
+    if (namespace == NULL || key == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to erase value: namespace or key is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    write_queue_drop(namespace, key);
+
+    nvs_handle_t nvs_handle;
+    esp_err_t err = esp32_nvs_open(namespace, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = nvs_erase_key(nvs_handle, key);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    stored_value_invalidate(namespace, key);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "Failed to erase NVS %s.%s: %d (%s)!", namespace, key, err, esp_err_to_name(err));
+    }
+
+    if (err == ESP_ERR_NVS_INVALID_HANDLE) {
+        handle_cache_invalidate(namespace);
+    }
+    return err;
+}
+
+// nvs_erase_value() without notifying subscribers, for internal keys erased with the namespace lock taken
+static esp_err_t esp32_nvs_erase_value_locked(const char *namespace, const char *key)
+{
+    nvs_lock_namespace(namespace);
+    esp_err_t err = esp32_nvs_erase_value(namespace, key);
+    nvs_unlock_namespace(namespace);
+    return err;
+}
+
+esp_err_t nvs_erase_value(const char *namespace, const char *key)
+{
+    esp_err_t err = esp32_nvs_erase_value_locked(namespace, key);
+    if (err == ESP_OK) {
+        subscriptions_notify(namespace, key, NVS_TYPE_ANY, NULL, 0);
+    }
+    return err;
+}
+
+static esp_err_t esp32_nvs_erase_namespace(const char *namespace)
+{
+    if (namespace == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to erase namespace: namespace is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    write_queue_drop(namespace, NULL);
+    state_lock();
+    for (size_t i = 0; i < NVS_COUNTER_MAX_COUNT; ++i) {
+        if (strcmp(counter_table.counters[i].namespace, namespace) == 0) {
+            counter_table.counters[i].in_use = false;  // Its slots are erased as well
+        }
+    }
+    state_unlock();
+
+    nvs_handle_t nvs_handle;
+    esp_err_t err = esp32_nvs_open(namespace, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = nvs_erase_all(nvs_handle);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs_handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to erase NVS namespace %s: %d (%s)!", namespace, err, esp_err_to_name(err));
+    }
+
+    // Drop every cached handle and value of the erased namespace, so no one keeps using a stale one
+    handle_cache_invalidate(namespace);
+    stored_value_invalidate(namespace, NULL);
+    return err;
+}
+
+esp_err_t nvs_erase_namespace(const char *namespace)
+{
+    nvs_lock_namespace(namespace);
+    esp_err_t err = esp32_nvs_erase_namespace(namespace);
+    nvs_unlock_namespace(namespace);
+    if (err == ESP_OK) {
+        subscriptions_notify(namespace, NULL, NVS_TYPE_ANY, NULL, 0);
+    }
+    return err;
+}
+
+#ifndef NVS_LOAD_BUFFER_SIZE
+#define NVS_LOAD_BUFFER_SIZE 64  // Initial size of the buffer strings and blobs are read into by nvs_load_namespace()
+#endif
+
+// Read the value of an entry found by the iterator, strings and blobs into *buffer which is grown as needed
+static esp_err_t load_entry(nvs_handle_t nvs_handle, const nvs_entry_info_t *info, uint64_t *scalar,
+                            void **buffer, size_t *capacity, size_t *length)
+{
+    if (info->type != NVS_TYPE_STR && info->type != NVS_TYPE_BLOB) {
+        *length = scalar_size(info->type);
+        return esp32_nvs_get(nvs_handle, info->key, info->type, scalar, NULL);
+    }
+
+    // Usually one lookup, a second one only if the value does not fit into the buffer
+    *length = *capacity;
+    esp_err_t err = esp32_nvs_get(nvs_handle, info->key, info->type, *buffer, length);
+    if (err == ESP_ERR_NVS_INVALID_LENGTH) {
+        void *grown = realloc(*buffer, *length);
+        if (grown == NULL) {
+            ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+            return ESP_ERR_NO_MEM;
+        }
+        *buffer = grown;
+        *capacity = *length;
+        err = esp32_nvs_get(nvs_handle, info->key, info->type, *buffer, length);
+    }
+    return err;
+}
+
+static esp_err_t esp32_nvs_load_namespace(const char *namespace, nvs_load_callback_t callback, void *ctx)
+{
+    if (namespace == NULL || callback == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to load namespace: namespace or callback is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    nvs_iterator_t iterator = NULL;
+    esp_err_t err = nvs_entry_find(NVS_DEFAULT_PART_NAME, namespace, NVS_TYPE_ANY, &iterator);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        NVS_LOGD(READ, "Namespace %s is empty", namespace);
+        return ESP_OK;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to iterate NVS namespace %s: %d (%s)", namespace, err, esp_err_to_name(err));
+        return err;
+    }
+
+    nvs_handle_t nvs_handle;
+    err = esp32_nvs_open(namespace, NVS_READONLY, &nvs_handle);
+
+    size_t capacity = NVS_LOAD_BUFFER_SIZE;
+    void *buffer = malloc(capacity);
+    if (err == ESP_OK && buffer == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+        err = ESP_ERR_NO_MEM;
+    }
+
+    size_t loaded = 0;
+    while (err == ESP_OK) {
+        nvs_entry_info_t info;
+        err = nvs_entry_info(iterator, &info);
+        if (err != ESP_OK) {
+            break;
+        }
+
+        uint64_t scalar = 0;
+        size_t length = 0;
+        err = load_entry(nvs_handle, &info, &scalar, &buffer, &capacity, &length);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to read from NVS %s.%s: %d (%s)", namespace, info.key, err, esp_err_to_name(err));
+            break;
+        }
+
+        const void *value = (info.type == NVS_TYPE_STR || info.type == NVS_TYPE_BLOB) ? buffer : &scalar;
+        stored_value_put(namespace, info.key, info.type, value, length);
+        ++loaded;
+
+        err = callback(info.key, info.type, value, length, ctx);
+        if (err != ESP_OK) {
+            break;  // Stopped by the caller
+        }
+
+        err = nvs_entry_next(&iterator);
+    }
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        err = ESP_OK;  // End of the namespace
+    }
+
+    nvs_release_iterator(iterator);
+    free(buffer);
+    if (err == ESP_OK) {
+        NVS_LOGI(READ, "Successfully load %u values from NVS namespace %s", (unsigned)loaded, namespace);
+    }
+    if (err == ESP_ERR_NVS_INVALID_HANDLE) {
+        handle_cache_invalidate(namespace);
+    }
+    return err;
+}
+
+esp_err_t nvs_load_namespace(const char *namespace, nvs_load_callback_t callback, void *ctx)
+{
+    // All namespace locks, the callback may use any namespace
+    nvs_lock();
+    esp_err_t err = esp32_nvs_load_namespace(namespace, callback, ctx);
+    nvs_unlock();
+    return err;
+}
+
+#define NVS_SNAPSHOT_INITIAL_CAPACITY 16  // Number of values the snapshot table is allocated for at first
+
+static esp_err_t snapshot_add(const char *key, nvs_type_t type_value, const void *value, size_t length, void *ctx)
+{
+    nvs_snapshot_t *snapshot = ctx;
+    if (snapshot->count == snapshot->capacity) {
+        size_t capacity = (snapshot->capacity == 0) ? NVS_SNAPSHOT_INITIAL_CAPACITY : snapshot->capacity * 2;
+        struct nvs_txn_op_s *entries = realloc(snapshot->entries, capacity * sizeof(*entries));
+        if (entries == NULL) {
+            ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+            return ESP_ERR_NO_MEM;
+        }
+        snapshot->entries = entries;
+        snapshot->capacity = capacity;
+    }
+
+    esp_err_t err = nvs_txn_op_init(&snapshot->entries[snapshot->count], key, type_value, value, length);
+    if (err == ESP_OK) {
+        ++snapshot->count;
+    }
+    return err;
+}
+
+static int snapshot_compare(const void *a, const void *b)
+{
+    return strcmp(((const struct nvs_txn_op_s*)a)->key, ((const struct nvs_txn_op_s*)b)->key);
+}
+
+esp_err_t nvs_snapshot_load(const char *namespace, nvs_snapshot_t *snapshot)
+{
+    if (snapshot == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to load snapshot: snapshot is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(snapshot, 0, sizeof(*snapshot));
+    esp_err_t err = nvs_load_namespace(namespace, snapshot_add, snapshot);
+    if (err != ESP_OK) {
+        nvs_snapshot_free(snapshot);
+        return err;
+    }
+
+    // Sorted by key for nvs_snapshot_get()
+    qsort(snapshot->entries, snapshot->count, sizeof(snapshot->entries[0]), snapshot_compare);
+    return ESP_OK;
+}
+
+esp_err_t nvs_snapshot_get(const nvs_snapshot_t *snapshot, const char *key, nvs_type_t type_value,
+                           void *value, size_t *length)
+{
+    if (snapshot == NULL || key == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to get value: snapshot or key is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if ((type_value == NVS_TYPE_STR || type_value == NVS_TYPE_BLOB) ? length == NULL : value == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to get value: value or length is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    struct nvs_txn_op_s wanted;
+    strcpy(wanted.key, key);
+    const struct nvs_txn_op_s *entry = bsearch(&wanted, snapshot->entries, snapshot->count,
+                                               sizeof(snapshot->entries[0]), snapshot_compare);
+    if (entry == NULL || entry->type != type_value) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    return copy_value_out(type_value, nvs_txn_op_value(entry), entry->length, value, length);
+}
+
+void nvs_snapshot_free(nvs_snapshot_t *snapshot)
+{
+    if (snapshot == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < snapshot->count; ++i) {
+        nvs_txn_op_free(&snapshot->entries[i]);
+    }
+    free(snapshot->entries);
+    memset(snapshot, 0, sizeof(*snapshot));
+}
+
+#define NVS_TXN_INITIAL_CAPACITY 8  // Number of operations the transaction buffer is allocated for at first
+
+static void nvs_txn_release(nvs_txn_t *txn)
+{
+    for (size_t i = 0; i < txn->count; ++i) {
+        nvs_txn_op_free(&txn->ops[i]);
+    }
+    free(txn->ops);
+    txn->ops = NULL;
+    txn->count = 0;
+    txn->capacity = 0;
+    txn->err = ESP_ERR_INVALID_STATE;  // The transaction is finished, it has to be started again with nvs_txn_begin()
+}
+
+esp_err_t nvs_txn_begin(const char *namespace, nvs_txn_t *txn)
+{
+    if (namespace == NULL || txn == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to begin transaction: namespace or transaction is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strlen(namespace) >= sizeof(txn->namespace_name)) {
+        ESP_LOGE(TAG, "%s(): Failed to begin transaction: namespace %s is too long!", __func__, namespace);
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+
+    memset(txn, 0, sizeof(*txn));
+    strcpy(txn->namespace_name, namespace);
+
+    // Open the namespace right away, so a wrong namespace is reported here and not at commit time
+    nvs_handle_t nvs_handle;
+    nvs_lock_namespace(namespace);
+    txn->err = esp32_nvs_open(namespace, NVS_READWRITE, &nvs_handle);
+    nvs_unlock_namespace(namespace);
+    return txn->err;
+}
+
+static esp_err_t nvs_txn_add(nvs_txn_t *txn, const char *key, nvs_type_t type_value, const void *value, size_t length)
+{
+    if (txn == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to add value: transaction is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (txn->err != ESP_OK) {
+        return txn->err;  // The transaction has already failed, it can only be aborted
+    }
+
+    if (key == NULL || value == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to add value: key or value is NULL!", __func__);
+        txn->err = ESP_ERR_INVALID_ARG;
+        return txn->err;
+    }
+    if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+        ESP_LOGE(TAG, "%s(): Failed to add value: key %s is too long!", __func__, key);
+        txn->err = ESP_ERR_NVS_KEY_TOO_LONG;
+        return txn->err;
+    }
+
+    if (txn->count == txn->capacity) {
+        size_t capacity = (txn->capacity == 0) ? NVS_TXN_INITIAL_CAPACITY : txn->capacity * 2;
+        struct nvs_txn_op_s *ops = realloc(txn->ops, capacity * sizeof(*ops));
+        if (ops == NULL) {
+            ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+            txn->err = ESP_ERR_NO_MEM;
+            return txn->err;
+        }
+        txn->ops = ops;
+        txn->capacity = capacity;
+    }
+
+    txn->err = nvs_txn_op_init(&txn->ops[txn->count], key, type_value, value, length);
+    if (txn->err != ESP_OK) {
+        return txn->err;
+    }
+
+    ++txn->count;
+    return ESP_OK;
+}
+
+esp_err_t nvs_txn_set_int8(nvs_txn_t *txn, const char *key, int8_t value)
+{
+    return nvs_txn_add(txn, key, NVS_TYPE_I8, &value, sizeof(value));
+}
+
+esp_err_t nvs_txn_set_uint8(nvs_txn_t *txn, const char *key, uint8_t value)
+{
+    return nvs_txn_add(txn, key, NVS_TYPE_U8, &value, sizeof(value));
+}
+
+esp_err_t nvs_txn_set_int16(nvs_txn_t *txn, const char *key, int16_t value)
+{
+    return nvs_txn_add(txn, key, NVS_TYPE_I16, &value, sizeof(value));
+}
+
+esp_err_t nvs_txn_set_uint16(nvs_txn_t *txn, const char *key, uint16_t value)
+{
+    return nvs_txn_add(txn, key, NVS_TYPE_U16, &value, sizeof(value));
+}
+
+esp_err_t nvs_txn_set_int32(nvs_txn_t *txn, const char *key, int32_t value)
+{
+    return nvs_txn_add(txn, key, NVS_TYPE_I32, &value, sizeof(value));
+}
+
+esp_err_t nvs_txn_set_uint32(nvs_txn_t *txn, const char *key, uint32_t value)
+{
+    return nvs_txn_add(txn, key, NVS_TYPE_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_txn_set_int64(nvs_txn_t *txn, const char *key, int64_t value)
+{
+    return nvs_txn_add(txn, key, NVS_TYPE_I64, &value, sizeof(value));
+}
+
+esp_err_t nvs_txn_set_uint64(nvs_txn_t *txn, const char *key, uint64_t value)
+{
+    return nvs_txn_add(txn, key, NVS_TYPE_U64, &value, sizeof(value));
+}
+
+esp_err_t nvs_txn_set_string(nvs_txn_t *txn, const char *key, const char *value)
+{
+    size_t length = (value != NULL) ? strlen(value) + 1 : 0;
+    return nvs_txn_add(txn, key, NVS_TYPE_STR, value, length);
+}
+
+esp_err_t nvs_txn_set_float(nvs_txn_t *txn, const char *key, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    esp_err_t err = nvs_txn_add(txn, key, NVS_TYPE_U32, &bits, sizeof(bits));
+    if (err == ESP_OK) {
+        txn->ops[txn->count - 1].floating = true;
+    }
+    return err;
+}
+
+esp_err_t nvs_txn_set_double(nvs_txn_t *txn, const char *key, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    esp_err_t err = nvs_txn_add(txn, key, NVS_TYPE_U64, &bits, sizeof(bits));
+    if (err == ESP_OK) {
+        txn->ops[txn->count - 1].floating = true;
+    }
+    return err;
+}
+
+esp_err_t nvs_txn_set_blob(nvs_txn_t *txn, const char *key, const void *value, size_t length)
+{
+    return nvs_txn_add(txn, key, NVS_TYPE_BLOB, value, length);
+}
+
+// Write and commit the operations, the caller releases the transaction afterwards
+static esp_err_t esp32_nvs_txn_commit(nvs_txn_t *txn)
+{
+    esp_err_t err = txn->err;
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s(): Transaction on NVS namespace %s has failed before commit: %d (%s)!",
+                 __func__, txn->namespace_name, err, esp_err_to_name(err));
+        return err;
+    }
+
+    nvs_handle_t nvs_handle;
+    err = esp32_nvs_open(txn->namespace_name, NVS_READWRITE, &nvs_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    NVS_METRIC_START(write_start);
+    size_t written = 0;
+#if NVS_ENABLE_METRICS
+    size_t written_bytes = 0;  // Counted once the commit succeeded
+#endif
+    for (size_t i = 0; i < txn->count && err == ESP_OK; ++i) {
+        struct nvs_txn_op_s *op = &txn->ops[i];
+        write_queue_drop(txn->namespace_name, op->key);  // Superseded by the transaction
+        op->unchanged = skip_unchanged_writes &&
+            value_unchanged(nvs_handle, txn->namespace_name, op->key, op->type, nvs_txn_op_value(op), op->length);
+        if (op->unchanged) {
+            state_lock();
+            ++elided_writes;
+            state_unlock();
+            continue;
+        }
+        err = esp32_nvs_set(nvs_handle, op->key, op->type, nvs_txn_op_value(op), op->length);
+        if (err == ESP_OK) {
+            state_lock();
+            entries_written += value_entries(op->type, nvs_txn_op_value(op), op->length);
+            state_unlock();
+        } else {
+            ESP_LOGE(TAG, "Failed to write to NVS %s.%s: %d (%s)!", txn->namespace_name, op->key, err,
+                     esp_err_to_name(err));
+        }
+        ++written;
+#if NVS_ENABLE_METRICS
+        written_bytes += op->length;
+#endif
+    }
+
+    if (err == ESP_OK && written > 0) {
+        err = nvs_commit(nvs_handle);
+        NVS_METRIC(++metrics.commits);
+        if (err == ESP_OK) {
+            NVS_METRIC(metrics.writes += written; metrics.bytes_written += written_bytes;
+                       metrics_add_latency(&metrics.write_latency, write_start));
+            NVS_LOGI(TXN, "Successfully write %u values to NVS namespace %s", (unsigned)written, txn->namespace_name);
+        } else {
+            ESP_LOGE(TAG, "Failed to commit NVS namespace %s: %d (%s)!", txn->namespace_name, err,
+                     esp_err_to_name(err));
+        }
+    }
+
+    if (err != ESP_OK) {
+        NVS_METRIC(metrics_add_error(err));
+    }
+    for (size_t i = 0; i < txn->count; ++i) {
+        const struct nvs_txn_op_s *op = &txn->ops[i];
+        if (err == ESP_OK) {
+            stored_value_put(txn->namespace_name, op->key, op->type, nvs_txn_op_value(op), op->length);
+        } else {
+            stored_value_invalidate(txn->namespace_name, op->key);
+        }
+    }
+
+    if (err == ESP_ERR_NVS_INVALID_HANDLE) {
+        handle_cache_invalidate(txn->namespace_name);
+    }
+    return err;
+}
+
+// Report the values written by a successful commit, called without the namespace lock
+static void txn_notify(const nvs_txn_t *txn)
+{
+    for (size_t i = 0; i < txn->count; ++i) {
+        const struct nvs_txn_op_s *op = &txn->ops[i];
+        nvs_type_t type_value = op->type;
+        if (op->floating) {
+            type_value = (op->type == NVS_TYPE_U64) ? NVS_CHANGE_DOUBLE : NVS_CHANGE_FLOAT;
+        }
+        if (!op->unchanged) {
+            subscriptions_notify(txn->namespace_name, op->key, type_value, nvs_txn_op_value(op), op->length);
+        }
+    }
+}
+
+esp_err_t nvs_txn_commit(nvs_txn_t *txn)
+{
+    if (txn == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to commit transaction: transaction is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    nvs_lock_namespace(txn->namespace_name);
+    esp_err_t err = esp32_nvs_txn_commit(txn);
+    nvs_unlock_namespace(txn->namespace_name);
+    if (err == ESP_OK) {
+        txn_notify(txn);
+    }
+    nvs_txn_release(txn);
+    return err;
+}
+
+void nvs_txn_abort(nvs_txn_t *txn)
+{
+    if (txn != NULL) {
+        nvs_txn_release(txn);
+    }
+}
+
+static esp_err_t check_fields(const nvs_field_t *fields, size_t field_count)
+{
+    for (size_t i = 0; i < field_count; ++i) {
+        const nvs_field_t *field = &fields[i];
+        if (field->key == NULL || strlen(field->key) >= NVS_KEY_NAME_MAX_SIZE) {
+            ESP_LOGE(TAG, "%s(): Field %u has no key or a too long one!", __func__, (unsigned)i);
+            return ESP_ERR_INVALID_ARG;
+        }
+        bool valid_size;
+        switch (field->type) {
+            case NVS_TYPE_STR:
+            case NVS_TYPE_BLOB:
+                valid_size = field->size > 0;
+                break;
+            case NVS_TYPE_ANY:
+                valid_size = false;
+                break;
+            default:
+                valid_size = field->size == scalar_size(field->type);
+                break;
+        }
+        if (!valid_size) {
+            ESP_LOGE(TAG, "%s(): Field %s has a wrong type or size!", __func__, field->key);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    return ESP_OK;
+}
+
+static void set_field_default(const nvs_field_t *field, uint8_t *destination)
+{
+    memset(destination, 0, field->size);
+    if (field->default_value == NULL) {
+        return;
+    }
+    if (field->type == NVS_TYPE_STR) {
+        strncpy((char*)destination, (const char*)field->default_value, field->size - 1);
+    } else {
+        memcpy(destination, field->default_value, field->size);
+    }
+}
+
+static esp_err_t esp32_nvs_struct_load(const char *namespace, const nvs_field_t *fields, size_t field_count,
+                                       void *record)
+{
+    size_t defaults = 0;
+    esp_err_t err = ESP_OK;
+    for (size_t i = 0; i < field_count && err == ESP_OK; ++i) {
+        const nvs_field_t *field = &fields[i];
+        uint8_t *destination = (uint8_t*)record + field->offset;
+
+        // Integers go through a buffer of the largest size, so a failed read leaves the field untouched
+        uint64_t scalar = 0;
+        bool is_scalar = field->type != NVS_TYPE_STR && field->type != NVS_TYPE_BLOB;
+        void *value = is_scalar ? (void*)&scalar : (void*)destination;
+        size_t length = field->size;
+        size_t *length_arg = is_scalar ? NULL : &length;
+
+        if (!write_queue_get(namespace, field->key, field->type, value, length_arg, &err)) {
+            err = esp32_nvs_read_stored(namespace, field->key, field->type, value, length_arg);
+        }
+        if (err == ESP_OK) {
+            if (is_scalar) {
+                memcpy(destination, &scalar, field->size);
+            } else if (field->type == NVS_TYPE_BLOB && length < field->size) {
+                memset(destination + length, 0, field->size - length);  // Stored by a version with a smaller field
+            }
+        } else if (err == ESP_ERR_NVS_NOT_FOUND) {
+            NVS_LOGD(READ, "Value %s.%s is not initialized yet, default used", namespace, field->key);
+            set_field_default(field, destination);
+            ++defaults;
+            err = ESP_OK;
+        } else {
+            ESP_LOGE(TAG, "Failed to read from NVS %s.%s: %d (%s)", namespace, field->key, err, esp_err_to_name(err));
+        }
+    }
+
+    if (err == ESP_OK) {
+        NVS_LOGI(READ, "Successfully load %u fields from NVS namespace %s, %u defaults", (unsigned)field_count,
+                 namespace, (unsigned)defaults);
+    }
+    return err;
+}
+
+esp_err_t nvs_struct_load(const char *namespace, const nvs_field_t *fields, size_t field_count, void *record)
+{
+    if (namespace == NULL || fields == NULL || record == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to load struct: namespace, fields or record is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = check_fields(fields, field_count);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // A namespace which was never written has only defaults, checked once instead of failing every read
+    nvs_lock_namespace(namespace);
+    nvs_iterator_t iterator = NULL;
+    bool empty = nvs_entry_find(NVS_DEFAULT_PART_NAME, namespace, NVS_TYPE_ANY, &iterator) == ESP_ERR_NVS_NOT_FOUND;
+    nvs_release_iterator(iterator);
+    if (empty && !write_queue_has_namespace(namespace)) {
+        for (size_t i = 0; i < field_count; ++i) {
+            set_field_default(&fields[i], (uint8_t*)record + fields[i].offset);
+        }
+        NVS_LOGW(READ, "NVS namespace %s is empty, defaults used", namespace);
+    } else {
+        err = esp32_nvs_struct_load(namespace, fields, field_count, record);
+    }
+    nvs_unlock_namespace(namespace);
+    return err;
+}
+
+esp_err_t nvs_struct_save(const char *namespace, const nvs_field_t *fields, size_t field_count, const void *record)
+{
+    if (namespace == NULL || fields == NULL || record == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to save struct: namespace, fields or record is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = check_fields(fields, field_count);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // A transaction gives one handle and one commit, and keeps the struct consistent with queued writes
+    nvs_txn_t txn = { 0 };
+    nvs_lock_namespace(namespace);
+    err = nvs_txn_begin(namespace, &txn);
+    for (size_t i = 0; i < field_count && err == ESP_OK; ++i) {
+        const nvs_field_t *field = &fields[i];
+        const uint8_t *source = (const uint8_t*)record + field->offset;
+        if (field->type == NVS_TYPE_STR && memchr(source, '\0', field->size) == NULL) {
+            ESP_LOGE(TAG, "%s(): Field %s is not zero-terminated!", __func__, field->key);
+            err = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        err = nvs_txn_add(&txn, field->key, field->type, source, field->size);
+    }
+    if (err == ESP_OK) {
+        err = esp32_nvs_txn_commit(&txn);
+    }
+    nvs_unlock_namespace(namespace);
+    if (err == ESP_OK) {
+        txn_notify(&txn);
+    }
+    nvs_txn_release(&txn);
+    return err;
+}
+
+#define NVS_REQ_PENDING (ESP_ERR_NVS_BASE + 0xFE)  // Result of a request nvs_read_multi() didn't read yet
+
+static esp_err_t check_request(const nvs_req_t *req)
+{
+    if (req->namespace_name == NULL || req->key == NULL || req->value == NULL || req->type == NVS_TYPE_ANY) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strlen(req->namespace_name) >= NVS_KEY_NAME_MAX_SIZE || strlen(req->key) >= NVS_KEY_NAME_MAX_SIZE) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    return NVS_REQ_PENDING;
+}
+
+static void read_stored_request(nvs_handle_t nvs_handle, esp_err_t open_err, nvs_req_t *req)
+{
+    bool is_scalar = req->type != NVS_TYPE_STR && req->type != NVS_TYPE_BLOB;
+    size_t *length = is_scalar ? NULL : &req->length;
+    if (write_queue_get(req->namespace_name, req->key, req->type, req->value, length, &req->result)) {
+        return;
+    }
+
+    // Counted like a single read: a queued value is not, a cached one is
+    NVS_METRIC_START(read_start);
+    if (!value_cache_get(req->namespace_name, req->key, req->type, req->value, length, &req->result)) {
+        // A namespace which can't be opened was never written, but the write queue may still hold its values
+        req->result = (open_err == ESP_OK) ? esp32_nvs_get(nvs_handle, req->key, req->type, req->value, length)
+                                           : open_err;
+        if (req->result == ESP_OK) {
+            stored_value_put(req->namespace_name, req->key, req->type, req->value, is_scalar ? 0 : req->length);
+        } else if (req->result == ESP_ERR_NVS_INVALID_HANDLE) {
+            handle_cache_invalidate(req->namespace_name);
+        }
+    }
+    NVS_METRIC(metrics_add_read(req->result, read_start));
+}
+
+// Blobs are decompressed like by nvs_read_blob()
+static void read_request(nvs_handle_t nvs_handle, esp_err_t open_err, nvs_req_t *req)
+{
+    size_t capacity = req->length;
+    read_stored_request(nvs_handle, open_err, req);
+    if (req->result == ESP_OK && req->type == NVS_TYPE_BLOB) {
+        req->result = blob_decompress(req->value, &req->length, capacity);
+    }
+}
+
+esp_err_t nvs_read_multi(nvs_req_t *reqs, size_t count)
+{
+    if (reqs == NULL && count > 0) {
+        ESP_LOGE(TAG, "%s(): Failed to read values: reqs is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        reqs[i].result = check_request(&reqs[i]);
+        if (reqs[i].result != NVS_REQ_PENDING) {
+            ESP_LOGE(TAG, "%s(): Request %u has no namespace, key or value, a too long name or NVS_TYPE_ANY!",
+                     __func__, (unsigned)i);
+        }
+    }
+
+    // The first pending request opens its namespace, which then serves all pending requests of that namespace
+    nvs_lock();
+    for (size_t first = 0; first < count; ++first) {
+        if (reqs[first].result != NVS_REQ_PENDING) {
+            continue;
+        }
+        const char *namespace = reqs[first].namespace_name;
+        nvs_handle_t nvs_handle = 0;
+        esp_err_t open_err = esp32_nvs_open(namespace, NVS_READONLY, &nvs_handle);
+        for (size_t i = first; i < count; ++i) {
+            if (reqs[i].result == NVS_REQ_PENDING && strcmp(reqs[i].namespace_name, namespace) == 0) {
+                read_request(nvs_handle, open_err, &reqs[i]);
+            }
+        }
+    }
+    nvs_unlock();
+
+    esp_err_t err = ESP_OK;
+    size_t missing = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const nvs_req_t *req = &reqs[i];
+        if (req->result == ESP_ERR_NVS_NOT_FOUND) {
+            NVS_LOGD(READ, "Value %s.%s is not initialized yet", req->namespace_name, req->key);
+            ++missing;
+        } else if (req->result != ESP_OK) {
+            if (req->namespace_name != NULL && req->key != NULL) {
+                ESP_LOGE(TAG, "Failed to read from NVS %s.%s: %d (%s)", req->namespace_name, req->key, req->result,
+                         esp_err_to_name(req->result));
+            }
+            if (err == ESP_OK) {
+                err = req->result;
+            }
+        }
+    }
+    if (err == ESP_OK) {
+        NVS_LOGI(READ, "Successfully read %u values from NVS, %u not found", (unsigned)(count - missing),
+                 (unsigned)missing);
+    }
+    return err;
+}
+
+/* Defaults */
+
+#ifndef NVS_DEFAULTS_MAX_NAMESPACES
+#define NVS_DEFAULTS_MAX_NAMESPACES 4  // Namespaces with pending defaults, one more writes the pending ones first
+#endif
+
+// Defaults to write back by nvs_defaults_flush(), one transaction per namespace
+static nvs_txn_t pending_defaults[NVS_DEFAULTS_MAX_NAMESPACES];
+
+static bool txn_has_key(const nvs_txn_t *txn, const char *key)
+{
+    for (size_t i = 0; i < txn->count; ++i) {
+        if (strcmp(txn->ops[i].key, key) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static esp_err_t esp32_nvs_defaults_flush(void)
+{
+    esp_err_t result = ESP_OK;
+    for (size_t i = 0; i < NVS_DEFAULTS_MAX_NAMESPACES; ++i) {
+        nvs_txn_t *txn = &pending_defaults[i];
+        if (txn->namespace_name[0] == '\0') {
+            continue;
+        }
+
+        // A default only fills a missing key, a value written since the read wins
+        size_t kept = 0;
+        for (size_t j = 0; j < txn->count; ++j) {
+            nvs_type_t type_value;
+            size_t length;
+            const char *key = txn->ops[j].key;
+            if (write_queue_stat(txn->namespace_name, key, &type_value, &length) ||
+                esp32_nvs_key_exists(txn->namespace_name, key, &type_value, &length) == ESP_OK) {
+                nvs_txn_op_free(&txn->ops[j]);
+            } else {
+                txn->ops[kept++] = txn->ops[j];
+            }
+        }
+        txn->count = kept;
+
+        esp_err_t err = (kept > 0) ? esp32_nvs_txn_commit(txn) : ESP_OK;
+        if (result == ESP_OK) {
+            result = err;
+        }
+        nvs_txn_release(txn);
+        memset(txn, 0, sizeof(*txn));
+    }
+    return result;
+}
+
+esp_err_t nvs_defaults_flush(void)
+{
+    nvs_lock();
+    esp_err_t err = esp32_nvs_defaults_flush();
+    nvs_unlock();
+    return err;
+}
+
+static void defaults_defer(const char *namespace, const char *key, nvs_type_t type_value, const void *value)
+{
+    nvs_lock();
+    nvs_txn_t *txn = NULL;
+    for (size_t i = 0; i < NVS_DEFAULTS_MAX_NAMESPACES && txn == NULL; ++i) {
+        if (strcmp(pending_defaults[i].namespace_name, namespace) == 0) {
+            txn = &pending_defaults[i];
+        }
+    }
+    for (size_t i = 0; i < NVS_DEFAULTS_MAX_NAMESPACES && txn == NULL; ++i) {
+        if (pending_defaults[i].namespace_name[0] == '\0') {
+            txn = &pending_defaults[i];
+        }
+    }
+    if (txn == NULL) {
+        esp32_nvs_defaults_flush();
+        txn = &pending_defaults[0];
+    }
+
+    if (txn->namespace_name[0] == '\0') {
+        strcpy(txn->namespace_name, namespace);
+    }
+    if (!txn_has_key(txn, key) && nvs_txn_add(txn, key, type_value, value, 0) != ESP_OK) {
+        txn->err = ESP_OK;  // Only this default is lost, the others are still written
+    }
+    nvs_unlock();
+}
+
+// Read a value without logging a missing one
+static esp_err_t read_quiet(const char *namespace, const char *key, nvs_type_t type_value, bool floating,
+                            void *value, size_t *length)
+{
+    esp_err_t err;
+    if (write_queue_get(namespace, key, type_value, value, length, &err)) {
+        return err;
+    }
+    nvs_lock_namespace(namespace);
+    NVS_METRIC_START(read_start);
+    err = floating ? read_stored_floating(namespace, key, value, type_value == NVS_TYPE_U64)
+                   : esp32_nvs_read_stored(namespace, key, type_value, value, length);
+    NVS_METRIC(metrics_add_read(err, read_start));
+    nvs_unlock_namespace(namespace);
+    return err;
+}
+
+static void esp32_nvs_read_or_default(const char *namespace, const char *key, nvs_type_t type_value, bool floating,
+                                      void *value, const void *default_value, uint32_t flags)
+{
+    if (namespace == NULL || key == NULL || strlen(namespace) >= NVS_KEY_NAME_MAX_SIZE ||
+        strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+        ESP_LOGE(TAG, "%s(): Failed to read value: namespace or key is NULL or too long, default used!", __func__);
+        memcpy(value, default_value, scalar_size(type_value));
+        return;
+    }
+
+    esp_err_t err = read_quiet(namespace, key, type_value, floating, value, NULL);
+    if (err == ESP_OK) {
+        return;
+    }
+    memcpy(value, default_value, scalar_size(type_value));
+    if (err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "Failed to read from NVS %s.%s, default used: %d (%s)", namespace, key, err,
+                 esp_err_to_name(err));
+    } else if ((flags & NVS_DEFAULT_PERSIST) != 0) {
+        defaults_defer(namespace, key, type_value, default_value);
+    }
+}
+
+int8_t nvs_read_int8_or_default(const char *namespace, const char *key, int8_t default_value, uint32_t flags)
+{
+    int8_t value;
+    esp32_nvs_read_or_default(namespace, key, NVS_TYPE_I8, false, &value, &default_value, flags);
+    return value;
+}
+
+uint8_t nvs_read_uint8_or_default(const char *namespace, const char *key, uint8_t default_value, uint32_t flags)
+{
+    uint8_t value;
+    esp32_nvs_read_or_default(namespace, key, NVS_TYPE_U8, false, &value, &default_value, flags);
+    return value;
+}
+
+int16_t nvs_read_int16_or_default(const char *namespace, const char *key, int16_t default_value, uint32_t flags)
+{
+    int16_t value;
+    esp32_nvs_read_or_default(namespace, key, NVS_TYPE_I16, false, &value, &default_value, flags);
+    return value;
+}
+
+uint16_t nvs_read_uint16_or_default(const char *namespace, const char *key, uint16_t default_value, uint32_t flags)
+{
+    uint16_t value;
+    esp32_nvs_read_or_default(namespace, key, NVS_TYPE_U16, false, &value, &default_value, flags);
+    return value;
+}
+
+int32_t nvs_read_int32_or_default(const char *namespace, const char *key, int32_t default_value, uint32_t flags)
+{
+    int32_t value;
+    esp32_nvs_read_or_default(namespace, key, NVS_TYPE_I32, false, &value, &default_value, flags);
+    return value;
+}
+
+uint32_t nvs_read_uint32_or_default(const char *namespace, const char *key, uint32_t default_value, uint32_t flags)
+{
+    uint32_t value;
+    esp32_nvs_read_or_default(namespace, key, NVS_TYPE_U32, false, &value, &default_value, flags);
+    return value;
+}
+
+int64_t nvs_read_int64_or_default(const char *namespace, const char *key, int64_t default_value, uint32_t flags)
+{
+    int64_t value;
+    esp32_nvs_read_or_default(namespace, key, NVS_TYPE_I64, false, &value, &default_value, flags);
+    return value;
+}
+
+uint64_t nvs_read_uint64_or_default(const char *namespace, const char *key, uint64_t default_value, uint32_t flags)
+{
+    uint64_t value;
+    esp32_nvs_read_or_default(namespace, key, NVS_TYPE_U64, false, &value, &default_value, flags);
+    return value;
+}
+
+// Floating values are stored and queued as their bit pattern
+float nvs_read_float_or_default(const char *namespace, const char *key, float default_value, uint32_t flags)
+{
+    float value;
+    esp32_nvs_read_or_default(namespace, key, NVS_TYPE_U32, true, &value, &default_value, flags);
+    return value;
+}
+
+double nvs_read_double_or_default(const char *namespace, const char *key, double default_value, uint32_t flags)
+{
+    double value;
+    esp32_nvs_read_or_default(namespace, key, NVS_TYPE_U64, true, &value, &default_value, flags);
+    return value;
+}
+
+esp_err_t nvs_read_string_or_default(const char *namespace, const char *key, const char *default_value,
+                                     char *buffer, size_t length, uint32_t flags)
+{
+    if (namespace == NULL || key == NULL || default_value == NULL || buffer == NULL || length == 0) {
+        ESP_LOGE(TAG, "%s(): Failed to read string: namespace, key, default or buffer is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strlen(namespace) >= NVS_KEY_NAME_MAX_SIZE || strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+        ESP_LOGE(TAG, "%s(): Failed to read string: namespace or key is too long!", __func__);
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+
+    size_t string_length = length;
+    esp_err_t err = read_quiet(namespace, key, NVS_TYPE_STR, false, buffer, &string_length);
+    if (err == ESP_OK) {
+        return ESP_OK;
+    }
+    if (err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "Failed to read from NVS %s.%s, default used: %d (%s)", namespace, key, err,
+                 esp_err_to_name(err));
+    }
+    if (strlen(default_value) >= length) {
+        buffer[0] = '\0';
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    strcpy(buffer, default_value);
+    if (err == ESP_ERR_NVS_NOT_FOUND && (flags & NVS_DEFAULT_PERSIST) != 0) {
+        defaults_defer(namespace, key, NVS_TYPE_STR, default_value);
+    }
+    return (err == ESP_ERR_NVS_NOT_FOUND) ? ESP_OK : err;
+}
+
+/* Record log */
+
+#define NVS_LOG_MAX_SEGMENTS 100  // Segment keys are "<name>.<index>" with a two-digit index
+
+typedef struct {
+    uint32_t segment;       // Sequence number of the segment, the newest one has the largest
+    uint32_t first_record;  // Sequence number of the first record in the segment
+} nvs_log_segment_header_t;
+
+typedef struct {
+    uint32_t segment_size;
+    uint32_t segment_count;
+    uint32_t first_record;  // Records before it are trimmed
+} nvs_log_meta_t;
+
+typedef uint16_t nvs_log_length_t;  // Stored in front of every record
+
+// A uint32_t slot may take ten digits; log names are short enough for the two digits NVS_LOG_MAX_SEGMENTS needs
+#define LOG_SEGMENT_KEY_SIZE (NVS_KEY_NAME_MAX_SIZE + 8)
+
+static void log_segment_key(const char *name, uint32_t slot, char *key)
+{
+    snprintf(key, LOG_SEGMENT_KEY_SIZE, "%s.%02u", name, (unsigned)slot);
+}
+
+// Read a blob from the write queue or from NVS without logging, for blobs which may be missing
+static esp_err_t read_blob_quiet(const char *namespace, const char *key, void *value, size_t *length)
+{
+    esp_err_t err;
+    if (!write_queue_get(namespace, key, NVS_TYPE_BLOB, value, length, &err)) {
+        nvs_lock_namespace(namespace);
+        err = esp32_nvs_read_stored(namespace, key, NVS_TYPE_BLOB, value, length);
+        nvs_unlock_namespace(namespace);
+    }
+    return err;
+}
+
+static esp_err_t log_write_meta(const nvs_log_t *log)
+{
+    nvs_log_meta_t meta = {
+        .segment_size = (uint32_t)log->segment_size,
+        .segment_count = log->segment_count,
+        .first_record = log->first_record,
+    };
+    esp_err_t err = esp32_nvs_store(log->namespace_name, log->name, NVS_TYPE_BLOB, &meta, sizeof(meta));
+    return (err == NVS_WRITE_UNCHANGED) ? ESP_OK : err;
+}
+
+// Read a stored segment, ESP_ERR_NVS_NOT_FOUND if its slot is empty or was already reused by a newer segment
+static esp_err_t log_read_segment(const nvs_log_t *log, uint32_t segment, uint8_t *buffer, size_t *used)
+{
+    char key[LOG_SEGMENT_KEY_SIZE];
+    log_segment_key(log->name, segment % log->segment_count, key);
+    *used = log->segment_size;
+    esp_err_t err = read_blob_quiet(log->namespace_name, key, buffer, used);
+    if (err == ESP_OK) {
+        nvs_log_segment_header_t header;
+        memcpy(&header, buffer, sizeof(header));
+        if (*used < sizeof(header) || header.segment != segment) {
+            err = ESP_ERR_NVS_NOT_FOUND;
+        }
+    }
+    return err;
+}
+
+/*
+ * Walk the records of a segment. The callback is NULL to count them only, the returned count includes trimmed
+ * records.
+ */
+static esp_err_t log_segment_records(const nvs_log_t *log, const uint8_t *buffer, size_t used,
+                                     nvs_log_callback_t callback, void *ctx, uint32_t *out_count)
+{
+    nvs_log_segment_header_t header;
+    memcpy(&header, buffer, sizeof(header));
+    uint32_t count = 0;
+    size_t offset = sizeof(header);
+    while (offset < used) {
+        nvs_log_length_t length;
+        if (offset + sizeof(length) > used) {
+            break;
+        }
+        memcpy(&length, buffer + offset, sizeof(length));
+        offset += sizeof(length);
+        if (offset + length > used) {
+            break;
+        }
+        uint32_t sequence = header.first_record + count;
+        if (callback != NULL && (int32_t)(sequence - log->first_record) >= 0) {
+            esp_err_t err = callback(sequence, buffer + offset, length, ctx);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+        offset += length;
+        ++count;
+    }
+    if (offset != used) {
+        ESP_LOGE(TAG, "%s(): Segment %" PRIu32 " of log %s.%s is corrupted!", __func__, header.segment,
+                 log->namespace_name, log->name);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (out_count != NULL) {
+        *out_count = count;
+    }
+    return ESP_OK;
+}
+
+static void log_start_segment(nvs_log_t *log, uint32_t segment)
+{
+    nvs_log_segment_header_t header = { .segment = segment, .first_record = log->next_record };
+    memcpy(log->buffer, &header, sizeof(header));
+    log->head_segment = segment;
+    log->used = sizeof(header);
+}
+
+// First segment which may still be stored, older ones were reused by the ring
+static uint32_t log_tail_segment(const nvs_log_t *log)
+{
+    return (log->head_segment >= log->segment_count) ? log->head_segment - (log->segment_count - 1) : 0;
+}
+
+// Find the segment with the largest sequence number and load it into the buffer of the log
+static esp_err_t log_find_head(nvs_log_t *log, uint8_t *scratch)
+{
+    bool found = false;
+    for (uint32_t slot = 0; slot < log->segment_count; ++slot) {
+        char key[LOG_SEGMENT_KEY_SIZE];
+        log_segment_key(log->name, slot, key);
+        size_t used = log->segment_size;
+        esp_err_t err = read_blob_quiet(log->namespace_name, key, scratch, &used);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            continue;
+        }
+        if (err != ESP_OK) {
+            return err;
+        }
+        nvs_log_segment_header_t header;
+        memcpy(&header, scratch, sizeof(header));
+        if (used < sizeof(header) || header.segment % log->segment_count != slot) {
+            ESP_LOGW(TAG, "%s(): Slot %s of log %s is corrupted, ignored", __func__, key, log->namespace_name);
+            continue;
+        }
+        if (!found || header.segment > log->head_segment) {
+            found = true;
+            memcpy(log->buffer, scratch, used);
+            log->head_segment = header.segment;
+            log->used = used;
+        }
+    }
+
+    if (!found) {
+        log_start_segment(log, 0);
+        return ESP_OK;
+    }
+    nvs_log_segment_header_t header;
+    memcpy(&header, log->buffer, sizeof(header));
+    uint32_t count;
+    esp_err_t err = log_segment_records(log, log->buffer, log->used, NULL, NULL, &count);
+    if (err == ESP_OK) {
+        log->next_record = header.first_record + count;
+    }
+    return err;
+}
+
+esp_err_t nvs_log_open(const char *namespace, const char *name, size_t segment_size, uint32_t segment_count,
+                       nvs_log_t *log)
+{
+    if (namespace == NULL || name == NULL || log == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to open log: namespace, name or log is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strlen(namespace) >= sizeof(log->namespace_name) || strlen(name) >= sizeof(log->name)) {
+        ESP_LOGE(TAG, "%s(): Failed to open log %s: namespace or name is too long!", __func__, name);
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    if (segment_count < 2 || segment_count > NVS_LOG_MAX_SEGMENTS || segment_size > UINT32_MAX ||
+        segment_size <= sizeof(nvs_log_segment_header_t) + sizeof(nvs_log_length_t)) {
+        ESP_LOGE(TAG, "%s(): Failed to open log %s: invalid segment size or count!", __func__, name);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(log, 0, sizeof(*log));
+    strcpy(log->namespace_name, namespace);
+    strcpy(log->name, name);
+    log->segment_size = segment_size;
+    log->segment_count = segment_count;
+    log->buffer = malloc(segment_size);
+    uint8_t *scratch = malloc(segment_size);
+    if (log->buffer == NULL || scratch == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+        free(scratch);
+        nvs_log_close(log);
+        return ESP_ERR_NO_MEM;
+    }
+
+    nvs_log_meta_t meta;
+    size_t length = sizeof(meta);
+    esp_err_t err = read_blob_quiet(namespace, name, &meta, &length);
+    if (err == ESP_OK && (length != sizeof(meta) || meta.segment_size != segment_size ||
+                          meta.segment_count != segment_count)) {
+        ESP_LOGE(TAG, "%s(): Log %s.%s exists with another segment size or count!", __func__, namespace, name);
+        err = ESP_ERR_INVALID_STATE;
+    } else if (err == ESP_ERR_NVS_NOT_FOUND) {
+        err = log_write_meta(log);
+    } else if (err == ESP_OK) {
+        log->first_record = meta.first_record;
+    }
+    if (err == ESP_OK) {
+        err = log_find_head(log, scratch);
+    }
+    free(scratch);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open log %s.%s: %d (%s)", namespace, name, err, esp_err_to_name(err));
+        nvs_log_close(log);
+        return err;
+    }
+    if ((int32_t)(log->next_record - log->first_record) < 0) {
+        log->first_record = log->next_record;  // Everything was trimmed before the last segments were written
+    }
+    NVS_LOGI(READ, "Successfully open log %s.%s, records %" PRIu32 "..%" PRIu32, namespace, name, log->first_record,
+             log->next_record);
+    return ESP_OK;
+}
+
+esp_err_t nvs_log_append(nvs_log_t *log, const void *record, size_t length)
+{
+    if (log == NULL || log->buffer == NULL || (record == NULL && length > 0)) {
+        ESP_LOGE(TAG, "%s(): Failed to append record: log is not open or record is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t required = sizeof(nvs_log_length_t) + length;
+    if (length > UINT16_MAX || sizeof(nvs_log_segment_header_t) + required > log->segment_size) {
+        ESP_LOGE(TAG, "%s(): Record of %u bytes doesn't fit into a segment of log %s!", __func__, (unsigned)length,
+                 log->name);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // A full segment continues in the next slot, which replaces the oldest segment once the ring is full
+    nvs_log_segment_header_t previous_header;
+    memcpy(&previous_header, log->buffer, sizeof(previous_header));
+    size_t previous_used = log->used;
+    if (log->used + required > log->segment_size) {
+        log_start_segment(log, log->head_segment + 1);
+    }
+
+    nvs_log_length_t record_length = (nvs_log_length_t)length;
+    memcpy(log->buffer + log->used, &record_length, sizeof(record_length));
+    if (length > 0) {
+        memcpy(log->buffer + log->used + sizeof(record_length), record, length);
+    }
+
+    // Only the head segment is written, its sequence number makes it the head again after a power loss
+    char key[LOG_SEGMENT_KEY_SIZE];
+    log_segment_key(log->name, log->head_segment % log->segment_count, key);
+    esp_err_t err = esp32_nvs_store(log->namespace_name, key, NVS_TYPE_BLOB, log->buffer, log->used + required);
+    if (err != ESP_OK && err != NVS_WRITE_UNCHANGED) {
+        memcpy(log->buffer, &previous_header, sizeof(previous_header));
+        log->head_segment = previous_header.segment;
+        log->used = previous_used;
+        return err;
+    }
+    log->used += required;
+    ++log->next_record;
+    return ESP_OK;
+}
+
+esp_err_t nvs_log_iterate(const nvs_log_t *log, nvs_log_callback_t callback, void *ctx)
+{
+    if (log == NULL || log->buffer == NULL || callback == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to iterate log: log is not open or callback is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint8_t *scratch = malloc(log->segment_size);
+    if (scratch == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = ESP_OK;
+    for (uint32_t segment = log_tail_segment(log); segment < log->head_segment && err == ESP_OK; ++segment) {
+        size_t used;
+        err = log_read_segment(log, segment, scratch, &used);
+        if (err == ESP_OK) {
+            err = log_segment_records(log, scratch, used, callback, ctx, NULL);
+        } else if (err == ESP_ERR_NVS_NOT_FOUND) {
+            err = ESP_OK;  // Trimmed
+        }
+    }
+    free(scratch);
+    if (err == ESP_OK) {
+        err = log_segment_records(log, log->buffer, log->used, callback, ctx, NULL);
+    }
+    return err;
+}
+
+esp_err_t nvs_log_trim(nvs_log_t *log, uint32_t sequence)
+{
+    if (log == NULL || log->buffer == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to trim log: log is not open!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if ((int32_t)(sequence - log->first_record) <= 0) {
+        return ESP_OK;
+    }
+    if ((int32_t)(sequence - log->next_record) > 0) {
+        sequence = log->next_record;
+    }
+
+    // The trim point is written first, so segments left after a power loss are hidden anyway
+    uint32_t previous_first = log->first_record;
+    log->first_record = sequence;
+    esp_err_t err = log_write_meta(log);
+    if (err != ESP_OK) {
+        log->first_record = previous_first;
+        return err;
+    }
+
+    // Erase the segments all of whose records are trimmed, the head segment is kept for the next appends
+    uint8_t *scratch = malloc(log->segment_size);
+    if (scratch == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+        return ESP_ERR_NO_MEM;
+    }
+    for (uint32_t segment = log_tail_segment(log); segment < log->head_segment && err == ESP_OK; ++segment) {
+        size_t used;
+        err = log_read_segment(log, segment, scratch, &used);
+        uint32_t count;
+        if (err == ESP_OK) {
+            err = log_segment_records(log, scratch, used, NULL, NULL, &count);
+        }
+        if (err == ESP_OK) {
+            nvs_log_segment_header_t header;
+            memcpy(&header, scratch, sizeof(header));
+            if ((int32_t)(header.first_record + count - sequence) > 0) {
+                break;
+            }
+            char key[LOG_SEGMENT_KEY_SIZE];
+            log_segment_key(log->name, segment % log->segment_count, key);
+            err = esp32_nvs_erase_value_locked(log->namespace_name, key);
+        }
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            err = ESP_OK;
+        }
+    }
+    free(scratch);
+    if (err == ESP_OK) {
+        NVS_LOGI(WRITE, "Successfully trim log %s.%s before record %" PRIu32, log->namespace_name, log->name, sequence);
+    }
+    return err;
+}
+
+void nvs_log_close(nvs_log_t *log)
+{
+    if (log != NULL) {
+        free(log->buffer);
+        log->buffer = NULL;
+    }
+}
+
+/* Chunked blobs */
+
+#ifndef NVS_CHUNKED_SHARD_SIZE
+#define NVS_CHUNKED_SHARD_SIZE 1024  // Size of the shards new chunked blobs are split into
+#endif
+
+#define NVS_CHUNKED_MAX_SHARDS 256  // Keeps the manifest small enough for the stack, 256 KiB with the default shards
+
+static const uint8_t CHUNKED_MAGIC[4] = { 'N', 'V', 'C', '1' };
+
+/*
+ * Every shard has two keys, "<key>.<index>" and "<key>:<index>". A new copy of a shard is written under the key the
+ * current one doesn't use, the manifest then switches to it and the old copy is erased, so a write interrupted by a
+ * power loss leaves the manifest pointing at complete shards of one version.
+ */
+typedef struct {
+    uint8_t magic[4];     // Tells a manifest from a blob of the same size
+    uint32_t length;      // Length of the whole blob
+    uint32_t shard_size;  // Length of every shard but the last one
+    uint8_t generations[NVS_CHUNKED_MAX_SHARDS / 8];  // Bit per shard, set if it is stored under "<key>:<index>"
+} nvs_chunked_manifest_t;
+
+#define CHUNKED_MANIFEST_HEADER_SIZE offsetof(nvs_chunked_manifest_t, generations)
+
+static uint32_t chunked_shard_count(const nvs_chunked_manifest_t *manifest)
+{
+    return (manifest->length + manifest->shard_size - 1) / manifest->shard_size;
+}
+
+// Every shard but the last one is full
+static size_t chunked_shard_length(size_t length, size_t shard_size, uint32_t shard)
+{
+    size_t shard_start = shard * shard_size;
+    return (length - shard_start < shard_size) ? length - shard_start : shard_size;
+}
+
+// Only the generation bits of the shards the blob has are stored
+static size_t chunked_manifest_size(const nvs_chunked_manifest_t *manifest)
+{
+    return CHUNKED_MANIFEST_HEADER_SIZE + (chunked_shard_count(manifest) + 7) / 8;
+}
+
+static void chunked_manifest_init(nvs_chunked_manifest_t *manifest, size_t length, size_t shard_size)
+{
+    memset(manifest, 0, sizeof(*manifest));
+    memcpy(manifest->magic, CHUNKED_MAGIC, sizeof(manifest->magic));
+    manifest->length = (uint32_t)length;
+    manifest->shard_size = (uint32_t)shard_size;
+}
+
+static bool chunked_manifest_valid(const nvs_chunked_manifest_t *manifest, size_t length)
+{
+    return length >= CHUNKED_MANIFEST_HEADER_SIZE &&
+           memcmp(manifest->magic, CHUNKED_MAGIC, sizeof(manifest->magic)) == 0 && manifest->shard_size > 0 &&
+           chunked_shard_count(manifest) <= NVS_CHUNKED_MAX_SHARDS && length == chunked_manifest_size(manifest);
+}
+
+static bool chunked_generation(const uint8_t *generations, uint32_t shard)
+{
+    return (generations[shard / 8] & (1 << (shard % 8))) != 0;
+}
+
+static void chunked_set_generation(nvs_chunked_manifest_t *manifest, uint32_t shard, bool generation)
+{
+    if (generation) {
+        manifest->generations[shard / 8] |= (uint8_t)(1 << (shard % 8));
+    } else {
+        manifest->generations[shard / 8] &= (uint8_t)~(1 << (shard % 8));
+    }
+}
+
+// Eight hex digits of a uint32_t shard; chunked_check_key() leaves room for the three "<key>.<index>" uses
+#define CHUNKED_SHARD_KEY_SIZE (NVS_KEY_NAME_MAX_SIZE + 5)
+
+static void chunked_shard_key(const char *key, bool generation, uint32_t shard, char *shard_key)
+{
+    snprintf(shard_key, CHUNKED_SHARD_KEY_SIZE, "%s%c%03" PRIx32, key, generation ? ':' : '.', shard);
+}
+
+static esp_err_t chunked_check_key(const char *namespace, const char *key)
+{
+    if (namespace == NULL || key == NULL) {
+        ESP_LOGE(TAG, "%s(): namespace or key is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strlen(namespace) >= NVS_KEY_NAME_MAX_SIZE || strlen(key) >= NVS_KEY_NAME_MAX_SIZE - 4) {
+        ESP_LOGE(TAG, "%s(): Namespace or key of %s is too long!", __func__, key);
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    return ESP_OK;
+}
+
+// ESP_ERR_NVS_TYPE_MISMATCH if key holds another value, without logging
+static esp_err_t chunked_probe_manifest(const char *namespace, const char *key, nvs_chunked_manifest_t *manifest)
+{
+    size_t length = sizeof(*manifest);
+    esp_err_t err = read_blob_quiet(namespace, key, manifest, &length);
+    if (err == ESP_ERR_NVS_INVALID_LENGTH || (err == ESP_OK && !chunked_manifest_valid(manifest, length))) {
+        err = ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+    return err;
+}
+
+static esp_err_t chunked_read_manifest(const char *namespace, const char *key, nvs_chunked_manifest_t *manifest)
+{
+    esp_err_t err = chunked_probe_manifest(namespace, key, manifest);
+    if (err == ESP_ERR_NVS_TYPE_MISMATCH) {
+        ESP_LOGE(TAG, "%s(): %s.%s is not a chunked blob!", __func__, namespace, key);
+    }
+    return err;
+}
+
+static esp_err_t chunked_write_manifest(const char *namespace, const char *key, const nvs_chunked_manifest_t *manifest)
+{
+    esp_err_t err = esp32_nvs_write_if_changed(namespace, key, NVS_TYPE_BLOB, manifest,
+                                               chunked_manifest_size(manifest));
+    return (err == NVS_WRITE_UNCHANGED) ? ESP_OK : err;
+}
+
+// Write a shard unless the stored one has the same content
+static esp_err_t chunked_write_shard(const char *namespace, const char *key, bool generation, uint32_t shard,
+                                     const void *data, size_t length)
+{
+    char shard_key[CHUNKED_SHARD_KEY_SIZE];
+    chunked_shard_key(key, generation, shard, shard_key);
+    esp_err_t err = esp32_nvs_write_if_changed(namespace, shard_key, NVS_TYPE_BLOB, data, length);
+    return (err == NVS_WRITE_UNCHANGED) ? ESP_OK : err;
+}
+
+// Read a shard, which has to be exactly expected bytes long
+static esp_err_t chunked_read_shard(const char *namespace, const char *key, bool generation, uint32_t shard,
+                                    void *data, size_t expected)
+{
+    char shard_key[CHUNKED_SHARD_KEY_SIZE];
+    chunked_shard_key(key, generation, shard, shard_key);
+    size_t length = expected;
+    esp_err_t err = read_blob_quiet(namespace, shard_key, data, &length);
+    if (err == ESP_OK && length != expected) {
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read shard %s of %s.%s: %d (%s)", shard_key, namespace, key, err,
+                 esp_err_to_name(err));
+    }
+    return err;
+}
+
+// Erase one copy of a shard, a missing one is no error
+static esp_err_t chunked_erase_shard(const char *namespace, const char *key, bool generation, uint32_t shard)
+{
+    char shard_key[CHUNKED_SHARD_KEY_SIZE];
+    chunked_shard_key(key, generation, shard, shard_key);
+    esp_err_t err = esp32_nvs_erase_value_locked(namespace, shard_key);
+    return (err == ESP_ERR_NVS_NOT_FOUND) ? ESP_OK : err;
+}
+
+// Generation bits of the stored version are kept behind the shard buffer
+static bool chunked_writer_generation(const nvs_chunked_writer_t *writer, uint32_t shard)
+{
+    return shard < writer->stored_shards && !chunked_generation(writer->buffer + writer->shard_size, shard);
+}
+
+static void chunked_writer_release(nvs_chunked_writer_t *writer)
+{
+    free(writer->buffer);
+    writer->buffer = NULL;
+    writer->err = ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t nvs_chunked_writer_begin(const char *namespace, const char *key, nvs_chunked_writer_t *writer)
+{
+    if (writer == NULL) {
+        ESP_LOGE(TAG, "%s(): writer is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(writer, 0, sizeof(*writer));
+    esp_err_t err = chunked_check_key(namespace, key);
+    if (err != ESP_OK) {
+        writer->err = ESP_ERR_INVALID_STATE;
+        return err;
+    }
+    strcpy(writer->namespace_name, namespace);
+    strcpy(writer->key, key);
+
+    // The shard size of the stored version is kept; any other value under the key is replaced
+    nvs_chunked_manifest_t manifest;
+    err = chunked_probe_manifest(namespace, key, &manifest);
+    if (err == ESP_OK) {
+        writer->shard_size = manifest.shard_size;
+        writer->stored_shards = chunked_shard_count(&manifest);
+    } else if (err == ESP_ERR_NVS_NOT_FOUND || err == ESP_ERR_NVS_TYPE_MISMATCH) {
+        writer->shard_size = NVS_CHUNKED_SHARD_SIZE;
+        err = ESP_OK;
+    }
+    if (err == ESP_OK) {
+        size_t generations_size = (writer->stored_shards + 7) / 8;
+        writer->buffer = malloc(writer->shard_size + generations_size);
+        if (writer->buffer != NULL) {
+            memcpy(writer->buffer + writer->shard_size, manifest.generations, generations_size);
+        } else {
+            ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+            err = ESP_ERR_NO_MEM;
+        }
+    }
+    if (err != ESP_OK) {
+        writer->err = ESP_ERR_INVALID_STATE;
+    }
+    return err;
+}
+
+esp_err_t nvs_chunked_writer_write(nvs_chunked_writer_t *writer, const void *data, size_t length)
+{
+    if (writer == NULL || (data == NULL && length > 0)) {
+        ESP_LOGE(TAG, "%s(): writer or data is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (writer->err != ESP_OK) {
+        return writer->err;
+    }
+    if (writer->buffer == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (writer->length + length > (size_t)NVS_CHUNKED_MAX_SHARDS * writer->shard_size ||
+        writer->length + length > UINT32_MAX) {
+        ESP_LOGE(TAG, "%s(): Chunked blob %s.%s is too large!", __func__, writer->namespace_name, writer->key);
+        writer->err = ESP_ERR_INVALID_SIZE;
+        return writer->err;
+    }
+
+    const uint8_t *source = data;
+    while (length > 0) {
+        size_t copied = writer->shard_size - writer->used;
+        if (copied > length) {
+            copied = length;
+        }
+        memcpy(writer->buffer + writer->used, source, copied);
+        writer->used += copied;
+        writer->length += copied;
+        source += copied;
+        length -= copied;
+        if (writer->used == writer->shard_size) {
+            uint32_t shard = (uint32_t)(writer->length / writer->shard_size) - 1;
+            esp_err_t err = chunked_write_shard(writer->namespace_name, writer->key,
+                                                chunked_writer_generation(writer, shard), shard, writer->buffer,
+                                                writer->used);
+            if (err != ESP_OK) {
+                writer->err = err;
+                return err;
+            }
+            writer->used = 0;
+        }
+    }
+    return ESP_OK;
+}
+
+// nvs_chunked_writer_finish() without notifying subscribers
+static esp_err_t esp32_nvs_chunked_writer_finish(nvs_chunked_writer_t *writer)
+{
+    esp_err_t err = (writer->buffer == NULL && writer->err == ESP_OK) ? ESP_ERR_INVALID_STATE : writer->err;
+    nvs_lock_namespace(writer->namespace_name);
+    if (err == ESP_OK && writer->used > 0) {
+        uint32_t shard = (uint32_t)(writer->length / writer->shard_size);
+        err = chunked_write_shard(writer->namespace_name, writer->key, chunked_writer_generation(writer, shard),
+                                  shard, writer->buffer, writer->used);
+    }
+
+    // The manifest switches to the new shards, then the shards of the stored version are erased
+    nvs_chunked_manifest_t manifest;
+    chunked_manifest_init(&manifest, writer->length, writer->shard_size);
+    for (uint32_t shard = 0; shard < chunked_shard_count(&manifest); ++shard) {
+        chunked_set_generation(&manifest, shard, chunked_writer_generation(writer, shard));
+    }
+    bool switched = false;
+    if (err == ESP_OK) {
+        err = chunked_write_manifest(writer->namespace_name, writer->key, &manifest);
+        switched = err == ESP_OK;
+    }
+    for (uint32_t shard = 0; switched && shard < writer->stored_shards && err == ESP_OK; ++shard) {
+        err = chunked_erase_shard(writer->namespace_name, writer->key, !chunked_writer_generation(writer, shard),
+                                  shard);
+    }
     if (err == ESP_OK) {
-        *(float*)out_value = strtof(string, NULL);
-        free(string);
+        NVS_LOGI(WRITE, "Successfully write chunked blob to NVS %s.%s: %" PRIu32 " bytes", writer->namespace_name,
+                 writer->key, manifest.length);
+    }
+    nvs_unlock_namespace(writer->namespace_name);
+    if (switched) {
+        chunked_writer_release(writer);
+    } else {
+        nvs_chunked_writer_abort(writer);
     }
     return err;
 }
 
-esp_err_t nvs_read_double(const char *namespace, const char *key, void *out_value)
+// The data went through the writer in pieces, subscribers only get the length
+esp_err_t nvs_chunked_writer_finish(nvs_chunked_writer_t *writer)
 {
-    char *string = NULL;
-    esp_err_t err = esp32_nvs_read(namespace, key, NVS_TYPE_STR, &string, 0);
+    if (writer == NULL) {
+        ESP_LOGE(TAG, "%s(): writer is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = esp32_nvs_chunked_writer_finish(writer);
     if (err == ESP_OK) {
-        *(double*)out_value = strtod(string, NULL);
-        free(string);
+        subscriptions_notify(writer->namespace_name, writer->key, NVS_TYPE_BLOB, NULL, writer->length);
     }
     return err;
 }
 
-esp_err_t nvs_read_blob(const char *namespace, const char *key, void *out_value, size_t length)
+void nvs_chunked_writer_abort(nvs_chunked_writer_t *writer)
+{
+    if (writer == NULL || writer->buffer == NULL) {
+        return;
+    }
+
+    // The new shards are not referenced by the manifest, the stored version stays as it was
+    uint32_t written = (uint32_t)((writer->length + writer->shard_size - 1) / writer->shard_size);
+    nvs_lock_namespace(writer->namespace_name);
+    for (uint32_t shard = 0; shard < written; ++shard) {
+        chunked_erase_shard(writer->namespace_name, writer->key, chunked_writer_generation(writer, shard), shard);
+    }
+    nvs_unlock_namespace(writer->namespace_name);
+    chunked_writer_release(writer);
+}
+
+esp_err_t nvs_chunked_write(const char *namespace, const char *key, const void *data, size_t length)
+{
+    nvs_chunked_writer_t writer;
+    esp_err_t err = nvs_chunked_writer_begin(namespace, key, &writer);
+    if (err == ESP_OK) {
+        err = nvs_chunked_writer_write(&writer, data, length);
+    }
+    if (err != ESP_OK) {
+        nvs_chunked_writer_abort(&writer);
+        return err;
+    }
+    err = esp32_nvs_chunked_writer_finish(&writer);
+    if (err == ESP_OK) {
+        subscriptions_notify(namespace, key, NVS_TYPE_BLOB, data, length);
+    }
+    return err;
+}
+
+static esp_err_t esp32_nvs_chunked_update(const char *namespace, const char *key, size_t offset, const uint8_t *data,
+                                          size_t length, uint8_t *buffer, nvs_chunked_manifest_t *manifest)
+{
+    size_t stored_length = manifest->length;
+    uint32_t stored_shards = chunked_shard_count(manifest);
+    size_t new_length = (offset + length > stored_length) ? offset + length : stored_length;
+    uint32_t shard_size = manifest->shard_size;
+
+    // Only the shards the range touches are read and written, each one under the key its stored copy doesn't use
+    esp_err_t err = ESP_OK;
+    uint32_t first = offset / shard_size;
+    uint32_t shard;
+    for (shard = first; shard * (size_t)shard_size < offset + length && err == ESP_OK; ++shard) {
+        size_t shard_start = shard * (size_t)shard_size;
+        size_t shard_length = (new_length - shard_start < shard_size) ? new_length - shard_start : shard_size;
+        size_t patch_start = (offset > shard_start) ? offset - shard_start : 0;
+        size_t patch_end = offset + length - shard_start;
+        if (patch_end > shard_length) {
+            patch_end = shard_length;
+        }
+        bool generation = shard < stored_shards && !chunked_generation(manifest->generations, shard);
+        if ((patch_start > 0 || patch_end < shard_length) && shard_start < stored_length) {
+            err = chunked_read_shard(namespace, key, chunked_generation(manifest->generations, shard), shard, buffer,
+                                     chunked_shard_length(stored_length, shard_size, shard));
+        }
+        chunked_set_generation(manifest, shard, generation);
+        if (err == ESP_OK) {
+            memcpy(buffer + patch_start, data + shard_start + patch_start - offset, patch_end - patch_start);
+            err = chunked_write_shard(namespace, key, generation, shard, buffer, shard_length);
+        }
+    }
+
+    manifest->length = (uint32_t)new_length;
+    if (err == ESP_OK) {
+        err = chunked_write_manifest(namespace, key, manifest);
+        for (uint32_t stale = first; err == ESP_OK && stale < shard && stale < stored_shards; ++stale) {
+            err = chunked_erase_shard(namespace, key, !chunked_generation(manifest->generations, stale), stale);
+        }
+    } else {
+        for (uint32_t written = first; written < shard; ++written) {
+            chunked_erase_shard(namespace, key, chunked_generation(manifest->generations, written), written);
+        }
+    }
+    return err;
+}
+
+esp_err_t nvs_chunked_update(const char *namespace, const char *key, size_t offset, const void *data, size_t length)
+{
+    esp_err_t err = chunked_check_key(namespace, key);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (data == NULL && length > 0) {
+        ESP_LOGE(TAG, "%s(): data is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    nvs_lock_namespace(namespace);
+    nvs_chunked_manifest_t manifest;
+    err = chunked_read_manifest(namespace, key, &manifest);
+    if (err == ESP_OK && offset > manifest.length) {
+        ESP_LOGE(TAG, "%s(): Offset %u is beyond the end of %s.%s!", __func__, (unsigned)offset, namespace, key);
+        err = ESP_ERR_INVALID_ARG;
+    }
+    if (err == ESP_OK && (offset + length > (size_t)NVS_CHUNKED_MAX_SHARDS * manifest.shard_size ||
+                          offset + length > UINT32_MAX)) {
+        ESP_LOGE(TAG, "%s(): Chunked blob %s.%s is too large!", __func__, namespace, key);
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    uint8_t *buffer = NULL;
+    if (err == ESP_OK) {
+        buffer = malloc(manifest.shard_size);
+        if (buffer == NULL) {
+            ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+            err = ESP_ERR_NO_MEM;
+        }
+    }
+    if (err == ESP_OK) {
+        err = esp32_nvs_chunked_update(namespace, key, offset, data, length, buffer, &manifest);
+    }
+    if (err == ESP_OK) {
+        NVS_LOGI(WRITE, "Successfully update chunked blob in NVS %s.%s: %u bytes at %u", namespace, key,
+                 (unsigned)length, (unsigned)offset);
+    }
+    free(buffer);
+    nvs_unlock_namespace(namespace);
+    if (err == ESP_OK) {
+        subscriptions_notify(namespace, key, NVS_TYPE_BLOB, NULL, manifest.length);
+    }
+    return err;
+}
+
+esp_err_t nvs_chunked_read(const char *namespace, const char *key, size_t offset, void *out_value, size_t length)
+{
+    esp_err_t err = chunked_check_key(namespace, key);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (out_value == NULL && length > 0) {
+        ESP_LOGE(TAG, "%s(): out_value is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    nvs_chunked_manifest_t manifest;
+    err = chunked_read_manifest(namespace, key, &manifest);
+    if (err == ESP_OK && (offset > manifest.length || length > manifest.length - offset)) {
+        ESP_LOGE(TAG, "%s(): Range %u+%u is beyond the end of %s.%s!", __func__, (unsigned)offset,
+                 (unsigned)length, namespace, key);
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    if (err != ESP_OK || length == 0) {
+        return err;
+    }
+
+    // Whole shards go straight into the caller's buffer, the partial ones at the ends through one shard buffer
+    uint8_t *destination = out_value;
+    uint8_t *buffer = NULL;
+    for (uint32_t shard = offset / manifest.shard_size; length > 0 && err == ESP_OK; ++shard) {
+        bool generation = chunked_generation(manifest.generations, shard);
+        size_t shard_length = chunked_shard_length(manifest.length, manifest.shard_size, shard);
+        size_t skip = offset - shard * (size_t)manifest.shard_size;
+        size_t copied = (shard_length - skip < length) ? shard_length - skip : length;
+        if (skip == 0 && copied == shard_length) {
+            err = chunked_read_shard(namespace, key, generation, shard, destination, shard_length);
+        } else {
+            if (buffer == NULL) {
+                buffer = malloc(manifest.shard_size);
+                if (buffer == NULL) {
+                    ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+                    err = ESP_ERR_NO_MEM;
+                    break;
+                }
+            }
+            err = chunked_read_shard(namespace, key, generation, shard, buffer, shard_length);
+            if (err == ESP_OK) {
+                memcpy(destination, buffer + skip, copied);
+            }
+        }
+        destination += copied;
+        offset += copied;
+        length -= copied;
+    }
+    free(buffer);
+    return err;
+}
+
+esp_err_t nvs_chunked_size(const char *namespace, const char *key, size_t *out_length)
+{
+    esp_err_t err = chunked_check_key(namespace, key);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (out_length == NULL) {
+        ESP_LOGE(TAG, "%s(): out_length is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    nvs_chunked_manifest_t manifest;
+    err = chunked_read_manifest(namespace, key, &manifest);
+    if (err == ESP_OK) {
+        *out_length = manifest.length;
+    }
+    return err;
+}
+
+esp_err_t nvs_chunked_erase(const char *namespace, const char *key)
+{
+    esp_err_t err = chunked_check_key(namespace, key);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // The manifest goes first, so a half-erased blob is not found anymore
+    nvs_lock_namespace(namespace);
+    nvs_chunked_manifest_t manifest;
+    err = chunked_read_manifest(namespace, key, &manifest);
+    if (err == ESP_OK) {
+        err = esp32_nvs_erase_value_locked(namespace, key);
+    }
+    for (uint32_t shard = 0; err == ESP_OK && shard < chunked_shard_count(&manifest); ++shard) {
+        err = chunked_erase_shard(namespace, key, chunked_generation(manifest.generations, shard), shard);
+    }
+    nvs_unlock_namespace(namespace);
+    if (err == ESP_OK) {
+        subscriptions_notify(namespace, key, NVS_TYPE_ANY, NULL, 0);
+    }
+    return err;
+}
+
+/* Blob readers and writers */
+
+/*
+ * Read a blob written by nvs_write_blob() or nvs_write_blob_compressed() into a heap buffer of its original length.
+ * NVS has no partial reads, so such a blob is read in one piece.
+ */
+static esp_err_t blob_load(const char *namespace, const char *key, size_t stored_length, uint8_t **out_blob,
+                           size_t *out_length)
+{
+    uint8_t *blob = malloc((stored_length > 0) ? stored_length : 1);
+    if (blob == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+        return ESP_ERR_NO_MEM;
+    }
+    size_t length = stored_length;
+    esp_err_t err = read_blob_quiet(namespace, key, blob, &length);
+    size_t original_length = (err == ESP_OK) ? compressed_original_length(blob, length) : 0;
+    if (original_length > 0) {
+        uint8_t *larger = realloc(blob, original_length);
+        if (larger != NULL) {
+            blob = larger;
+            err = blob_decompress(blob, &length, original_length);
+        } else {
+            ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+            err = ESP_ERR_NO_MEM;
+        }
+    }
+    if (err != ESP_OK) {
+        free(blob);
+        return err;
+    }
+    *out_blob = blob;
+    *out_length = length;
+    return ESP_OK;
+}
+
+// Find out whether key holds a chunked blob, reading at most its manifest
+static esp_err_t blob_stat(const char *namespace, const char *key, size_t *stored_length,
+                           nvs_chunked_manifest_t *manifest, bool *chunked)
+{
+    *stored_length = 0;
+    esp_err_t err = read_blob_quiet(namespace, key, NULL, stored_length);
+    *chunked = false;
+    if (err == ESP_OK && *stored_length >= CHUNKED_MANIFEST_HEADER_SIZE && *stored_length <= sizeof(*manifest)) {
+        size_t length = sizeof(*manifest);
+        err = read_blob_quiet(namespace, key, manifest, &length);
+        *chunked = err == ESP_OK && chunked_manifest_valid(manifest, length);
+    }
+    return err;
+}
+
+esp_err_t nvs_blob_size(const char *namespace, const char *key, size_t *out_length)
+{
+    if (namespace == NULL || key == NULL || out_length == NULL) {
+        ESP_LOGE(TAG, "%s(): namespace, key or out_length is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t stored_length;
+    nvs_chunked_manifest_t manifest;
+    bool chunked;
+    esp_err_t err = blob_stat(namespace, key, &stored_length, &manifest, &chunked);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (chunked) {
+        *out_length = manifest.length;
+        return ESP_OK;
+    }
+
+    // Only a compressed blob needs its header, which can't be read without the rest; it isn't decompressed
+    if (stored_length <= sizeof(nvs_compressed_header_t)) {
+        *out_length = stored_length;
+        return ESP_OK;
+    }
+    uint8_t *blob = malloc(stored_length);
+    if (blob == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+        return ESP_ERR_NO_MEM;
+    }
+    size_t length = stored_length;
+    err = read_blob_quiet(namespace, key, blob, &length);
+    if (err == ESP_OK) {
+        size_t original_length = compressed_original_length(blob, length);
+        *out_length = (original_length > 0) ? original_length : length;
+    }
+    free(blob);
+    return err;
+}
+
+esp_err_t nvs_blob_reader_open(const char *namespace, const char *key, nvs_blob_reader_t *reader)
+{
+    if (namespace == NULL || key == NULL || reader == NULL) {
+        ESP_LOGE(TAG, "%s(): namespace, key or reader is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(reader, 0, sizeof(*reader));
+    if (strlen(namespace) >= sizeof(reader->namespace_name) || strlen(key) >= sizeof(reader->key)) {
+        ESP_LOGE(TAG, "%s(): Namespace or key of %s is too long!", __func__, key);
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    strcpy(reader->namespace_name, namespace);
+    strcpy(reader->key, key);
+
+    size_t stored_length;
+    nvs_chunked_manifest_t manifest;
+    bool chunked;
+    esp_err_t err = blob_stat(namespace, key, &stored_length, &manifest, &chunked);
+    if (err == ESP_OK && chunked) {
+        // One shard at a time
+        reader->length = manifest.length;
+        reader->shard_size = manifest.shard_size;
+        reader->shard = UINT32_MAX;
+        size_t generations_size = (chunked_shard_count(&manifest) + 7) / 8;
+        reader->buffer = malloc(manifest.shard_size + generations_size);
+        if (reader->buffer != NULL) {
+            memcpy(reader->buffer + manifest.shard_size, manifest.generations, generations_size);
+        } else {
+            ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+            err = ESP_ERR_NO_MEM;
+        }
+    } else if (err == ESP_OK) {
+        err = blob_load(namespace, key, stored_length, &reader->buffer, &reader->length);
+    }
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGE(TAG, "Failed to open blob %s.%s: %d (%s)", namespace, key, err, esp_err_to_name(err));
+    }
+    return err;
+}
+
+esp_err_t nvs_blob_reader_read(nvs_blob_reader_t *reader, void *buffer, size_t size, size_t *out_read)
+{
+    if (reader == NULL || out_read == NULL || (buffer == NULL && size > 0)) {
+        ESP_LOGE(TAG, "%s(): reader, buffer or out_read is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out_read = 0;
+    if (reader->buffer == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    uint8_t *destination = buffer;
+    while (size > 0 && reader->position < reader->length) {
+        const uint8_t *source;
+        size_t available;
+        if (reader->shard_size == 0) {
+            source = reader->buffer + reader->position;
+            available = reader->length - reader->position;
+        } else {
+            uint32_t shard = (uint32_t)(reader->position / reader->shard_size);
+            size_t shard_start = shard * reader->shard_size;
+            size_t shard_length = chunked_shard_length(reader->length, reader->shard_size, shard);
+            if (shard != reader->shard) {
+                // The generation bits of the manifest are kept behind the shard buffer
+                bool generation = chunked_generation(reader->buffer + reader->shard_size, shard);
+                esp_err_t err = chunked_read_shard(reader->namespace_name, reader->key, generation, shard,
+                                                   reader->buffer, shard_length);
+                if (err != ESP_OK) {
+                    reader->shard = UINT32_MAX;
+                    return err;
+                }
+                reader->shard = shard;
+            }
+            source = reader->buffer + (reader->position - shard_start);
+            available = shard_start + shard_length - reader->position;
+        }
+
+        size_t copied = (available < size) ? available : size;
+        memcpy(destination, source, copied);
+        destination += copied;
+        size -= copied;
+        reader->position += copied;
+        *out_read += copied;
+    }
+    return ESP_OK;
+}
+
+void nvs_blob_reader_close(nvs_blob_reader_t *reader)
+{
+    if (reader != NULL) {
+        free(reader->buffer);
+        reader->buffer = NULL;
+    }
+}
+
+esp_err_t nvs_blob_writer_open(const char *namespace, const char *key, nvs_blob_writer_t *writer)
 {
-    return esp32_nvs_read(namespace, key, NVS_TYPE_BLOB, out_value, length);
+    return nvs_chunked_writer_begin(namespace, key, writer);
+}
+
+esp_err_t nvs_blob_writer_write(nvs_blob_writer_t *writer, const void *data, size_t length)
+{
+    return nvs_chunked_writer_write(writer, data, length);
+}
+
+esp_err_t nvs_blob_writer_close(nvs_blob_writer_t *writer)
+{
+    return nvs_chunked_writer_finish(writer);
+}
+
+/* Idle maintenance */
+
+#define MAINTENANCE_NAMESPACE   "nvs_maint"
+#define MAINTENANCE_FILLER_KEY  "filler"
+#define MAINTENANCE_MARKER_KEY  "marker"
+#define MAINTENANCE_FILLER_SIZE ((NVS_ENTRIES_PER_PAGE - 1) * 32)  // With its header and terminator, a whole page
+#define MAINTENANCE_MIN_FREE_PAGES    2  // Floor of the derived min_free_entries, the reserve page and the active one
+#define MAINTENANCE_MIN_WRITTEN_PAGES 4  // Floor of the derived min_written_entries, a pass adds at most a quarter
+
+#define MAINTENANCE_STOP_BIT   (1 << 0)  // The task has to exit
+#define MAINTENANCE_EXITED_BIT (1 << 1)  // The task has exited
+
+static struct {
+    EventGroupHandle_t events;
+    nvs_maintenance_config_t config;
+    bool running;
+    size_t entries_at_pass;  // entries_written after the last working pass
+} maintenance;               // Protected by the state lock
+
+esp_err_t nvs_maintenance_run(const nvs_maintenance_config_t *config, bool *out_worked)
+{
+    if (out_worked != NULL) {
+        *out_worked = false;
+    }
+    if (config == NULL) {
+        ESP_LOGE(TAG, "%s(): config is NULL!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    nvs_stats_t stats;
+    esp_err_t err = nvs_get_stats(NULL, &stats);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s(): Failed to get NVS statistics: %d (%s)!", __func__, err, esp_err_to_name(err));
+        return err;
+    }
+    // Thresholds of 0 scale with the partition: a quarter of its entries free, a quarter written since the last pass
+    size_t min_free_entries = config->min_free_entries;
+    if (min_free_entries == 0) {
+        min_free_entries = stats.total_entries / 4;
+        if (min_free_entries < MAINTENANCE_MIN_FREE_PAGES * NVS_ENTRIES_PER_PAGE) {
+            min_free_entries = MAINTENANCE_MIN_FREE_PAGES * NVS_ENTRIES_PER_PAGE;
+        }
+    }
+    size_t min_written_entries = config->min_written_entries;
+    if (min_written_entries == 0) {
+        min_written_entries = stats.total_entries / 4;
+        if (min_written_entries < MAINTENANCE_MIN_WRITTEN_PAGES * NVS_ENTRIES_PER_PAGE) {
+            min_written_entries = MAINTENANCE_MIN_WRITTEN_PAGES * NVS_ENTRIES_PER_PAGE;
+        }
+    }
+    state_lock();
+    size_t written = entries_written - maintenance.entries_at_pass;
+    state_unlock();
+    if (stats.free_entries >= min_free_entries || written < min_written_entries) {
+        return ESP_OK;
+    }
+
+    char *filler = malloc(MAINTENANCE_FILLER_SIZE);
+    if (filler == NULL) {
+        ESP_LOGE(TAG, "%s(): Failed to allocate memory", __func__);
+        return ESP_ERR_NO_MEM;
+    }
+    memset(filler, 'f', MAINTENANCE_FILLER_SIZE - 1);
+    filler[MAINTENANCE_FILLER_SIZE - 1] = '\0';
+
+    // A string never spans pages: the filler fills a page of its own, the marker then has to start the next one.
+    // A handle of its own, the pass is rare and should not evict a cached one.
+    TickType_t start = xTaskGetTickCount();
+    nvs_lock_namespace(MAINTENANCE_NAMESPACE);
+    nvs_handle_t nvs_handle;
+    err = nvs_open(MAINTENANCE_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err == ESP_OK) {
+        err = nvs_set_str(nvs_handle, MAINTENANCE_FILLER_KEY, filler);
+        if (err == ESP_OK) {
+            err = nvs_set_u8(nvs_handle, MAINTENANCE_MARKER_KEY, 0);
+        }
+        if (err == ESP_OK) {
+            err = nvs_erase_all(nvs_handle);
+        }
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs_handle);
+        }
+        nvs_close(nvs_handle);
+    }
+    nvs_unlock_namespace(MAINTENANCE_NAMESPACE);
+    free(filler);
+
+    // Not retried before enough is written again, also when the filler did not fit
+    state_lock();
+    maintenance.entries_at_pass = entries_written;
+    state_unlock();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s(): Failed to write the page filler: %d (%s)!", __func__, err, esp_err_to_name(err));
+        return err;
+    }
+    NVS_LOGI(MAINT, "Idle maintenance wrote a page filler in %" PRIu32 " ms, %u free entries",
+             (uint32_t)pdTICKS_TO_MS(xTaskGetTickCount() - start), (unsigned)stats.free_entries);
+    if (out_worked != NULL) {
+        *out_worked = true;
+    }
+    return ESP_OK;
+}
+
+static void maintenance_task(void *arg)
+{
+    (void)arg;
+    while ((xEventGroupWaitBits(maintenance.events, MAINTENANCE_STOP_BIT, pdFALSE, pdFALSE,
+                                pdMS_TO_TICKS(maintenance.config.interval_ms)) & MAINTENANCE_STOP_BIT) == 0) {
+        nvs_maintenance_run(&maintenance.config, NULL);
+    }
+    xEventGroupSetBits(maintenance.events, MAINTENANCE_EXITED_BIT);
+    vTaskDelete(NULL);
+}
+
+esp_err_t nvs_maintenance_start(const nvs_maintenance_config_t *config)
+{
+    if (config == NULL || config->interval_ms == 0) {
+        ESP_LOGE(TAG, "%s(): Invalid configuration!", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (maintenance.events == NULL) {
+        maintenance.events = xEventGroupCreate();
+        if (maintenance.events == NULL) {
+            ESP_LOGE(TAG, "%s(): Failed to create the event group", __func__);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    state_lock();
+    bool running = maintenance.running;
+    if (!running) {
+        maintenance.config = *config;
+        maintenance.running = true;
+    }
+    state_unlock();
+    if (running) {
+        ESP_LOGE(TAG, "%s(): Maintenance task is already running!", __func__);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xEventGroupClearBits(maintenance.events, MAINTENANCE_STOP_BIT | MAINTENANCE_EXITED_BIT);
+    if (xTaskCreate(maintenance_task, "nvs_maintenance", config->task_stack_size, NULL, config->task_priority,
+                    NULL) != pdPASS) {
+        ESP_LOGE(TAG, "%s(): Failed to create the maintenance task", __func__);
+        state_lock();
+        maintenance.running = false;
+        state_unlock();
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_maintenance_stop(void)
+{
+    state_lock();
+    bool running = maintenance.running;
+    maintenance.running = false;
+    state_unlock();
+    if (!running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xEventGroupSetBits(maintenance.events, MAINTENANCE_STOP_BIT);
+    xEventGroupWaitBits(maintenance.events, MAINTENANCE_EXITED_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+    return ESP_OK;
 }